@@ -79,15 +79,7 @@ int main(int argc, char *argv[]) {
             return 1;
         }
 
-        uint32_t *pixels = (uint32_t*)surface->pixels;
-        for (int y = 0; y < AGNES_SCREEN_HEIGHT; y++) {
-            for (int x = 0; x < AGNES_SCREEN_WIDTH; x++) {
-                agnes_color_t c = agnes_get_screen_pixel(agnes, x, y);
-                int ix = (y * AGNES_SCREEN_WIDTH) + x;
-                uint32_t c_val = c.a << 24 | c.r << 16 | c.g << 8 | c.b;
-                pixels[ix] = c_val;
-            }
-        }
+        agnes_get_screen_rgba(agnes, surface->pixels, surface->pitch, AGNES_PIXEL_FORMAT_ARGB8888);
 
         SDL_UpdateTexture(texture, NULL, surface->pixels, surface->pitch);
         SDL_RenderCopy(sdl_renderer, texture, NULL, &window_size);
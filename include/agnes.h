@@ -43,7 +43,8 @@ extern "C"
 
 enum {
     AGNES_SCREEN_WIDTH = 256,
-    AGNES_SCREEN_HEIGHT = 240
+    AGNES_SCREEN_HEIGHT = 240,
+    AGNES_AUDIO_BUFFER_SIZE = 16384 // samples
 };
 
 typedef struct {
@@ -64,22 +65,85 @@ typedef struct {
     uint8_t a;
 } agnes_color_t;
 
+typedef enum {
+    AGNES_PIXEL_FORMAT_RGBA8888 = 0, // 32 bit values, r in the highest byte
+    AGNES_PIXEL_FORMAT_BGRA8888,
+    AGNES_PIXEL_FORMAT_ARGB8888,
+    AGNES_PIXEL_FORMAT_RGB565, // 16 bit values
+} agnes_pixel_format_t;
+
+typedef enum {
+    AGNES_CPU_MODE_INTERPRETER = 0, // one instruction per agnes_tick
+    AGNES_CPU_MODE_BLOCKS, // straight-line PRG-ROM code runs in blocks between PPU events
+    AGNES_CPU_MODE_SCHEDULED, // CPU runs until the next PPU event, PPU and APU catch up when accessed
+} agnes_cpu_mode_t;
+
+typedef enum {
+    AGNES_AUDIO_MODE_FULL = 0, // samples are generated
+    AGNES_AUDIO_MODE_TIMING, // no samples, only what games can observe runs (length counters, IRQ flags, DMC reads)
+    AGNES_AUDIO_MODE_OFF, // APU isn't run at all, games waiting on $4015 can behave differently
+} agnes_audio_mode_t;
+
+typedef struct {
+    agnes_cpu_mode_t cpu_mode;
+    bool skip_idle_loops; // fast-forwards loops waiting for an interrupt or PPUSTATUS change
+    agnes_audio_mode_t audio_mode;
+    int audio_sample_rate; // 8000 - 96000 Hz, 0 for 44100
+} agnes_config_t; // zero initialized config gives the defaults
+
+// Called with count == block_size samples every time that many are produced, samples are only valid during the call
+typedef void (*agnes_audio_callback_t)(void *user_data, const int16_t *samples, int count);
+
+typedef struct {
+    const char *name;
+    uint64_t count;
+} agnes_fusion_stat_t;
+
 typedef struct agnes agnes_t;
 typedef struct agnes_state agnes_state_t;
+typedef struct agnes_static_code agnes_static_code_t; // generated with utils/recompile.py
 
 agnes_t* agnes_make(void);
+agnes_t* agnes_make_with_config(const agnes_config_t *config);
 void agnes_destroy(agnes_t *agn);
 bool agnes_load_ines_data(agnes_t *agnes, void *data, size_t data_size);
+bool agnes_set_static_code(agnes_t *agnes, const agnes_static_code_t *code); // after loading, NULL to remove
 void agnes_set_input(agnes_t *agnes, const agnes_input_t *input_1, const agnes_input_t *input_2);
 size_t agnes_state_size(void);
 void agnes_dump_state(const agnes_t *agnes, agnes_state_t *out_res);
 bool agnes_restore_state(agnes_t *agnes, const agnes_state_t *state);
 bool agnes_tick(agnes_t *agnes, bool *out_new_frame);
 bool agnes_next_frame(agnes_t *agnes);
+// Pixels aren't drawn while set, the game runs exactly the same (sprite 0 hits, sprite overflow and MMC3 IRQs).
+// Lines drawn with rendering disabled keep what was drawn there last, like they do when not skipping.
+void agnes_set_skip_rendering(agnes_t *agnes, bool skip);
 
 agnes_color_t agnes_get_screen_pixel(const agnes_t *agnes, int x, int y);
+// Converts the whole screen at once, stride is the distance between rows of dst in bytes
+void agnes_get_screen_rgba(const agnes_t *agnes, void *dst, size_t stride, agnes_pixel_format_t format);
+// AGNES_SCREEN_WIDTH * AGNES_SCREEN_HEIGHT color indices (0-63) into the palette, valid until the next tick
+const uint8_t* agnes_get_screen_indices(const agnes_t *agnes);
+// 64 colors used for converting indices, the default one unless agnes_set_palette was called
+const agnes_color_t* agnes_get_palette(const agnes_t *agnes);
+// palette has to have 64 colors and stay valid while it's set, NULL restores the default one
+void agnes_set_palette(agnes_t *agnes, const agnes_color_t *palette);
+// AGNES_SCREEN_HEIGHT flags, nonzero for lines that differ from the previous frame. Updated when a frame
+// ends, all lines are marked after loading a game or restoring a state.
+const uint8_t* agnes_get_changed_lines(const agnes_t *agnes);
+// AGNES_SCREEN_HEIGHT hashes of each line's color indices, updated along with agnes_get_changed_lines
+const uint32_t* agnes_get_line_hashes(const agnes_t *agnes);
+
+// How many times each fused instruction sequence ran in block mode, returns the number of sequences
+int agnes_get_fusion_stats(const agnes_t *agnes, agnes_fusion_stat_t *out_stats, int max_count);
 
 // Audio functions
+// Samples are mono and buffered in a ring of AGNES_AUDIO_BUFFER_SIZE, the oldest ones are dropped when it's full
+int agnes_get_audio_sample_rate(const agnes_t *agnes);
+// Moves up to max_count buffered samples to dst, returns how many were moved
+int agnes_read_audio(agnes_t *agnes, int16_t *dst, int max_count);
+// Buffered samples go to the callback in blocks instead (1 - AGNES_AUDIO_BUFFER_SIZE samples), NULL to remove it
+bool agnes_set_audio_callback(agnes_t *agnes, agnes_audio_callback_t callback, int block_size, void *user_data);
+// Copies the oldest buffered samples without removing them, missing samples are zeroed
 void agnes_get_audio_samples(const agnes_t *agnes, int16_t *samples, int count);
 
 #ifdef __cplusplus
@@ -1,6 +1,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 #ifndef AGNES_AMALGAMATED
 #include "agnes.h"
 
@@ -10,6 +14,10 @@
 #include "cpu.h"
 #include "ppu.h"
 #include "apu.h"
+#include "instructions.h"
+#include "blocks.h"
+#include "idle.h"
+#include "scheduler.h"
 
 #include "mapper.h"
 #endif
@@ -41,6 +49,9 @@ typedef struct agnes_state {
 } agnes_state_t;
 
 static uint8_t get_input_byte(const agnes_input_t* input);
+static void tick_stall(agnes_t *agnes, bool *out_new_frame);
+static uint32_t convert_color(agnes_color_t c, agnes_pixel_format_t format);
+static void convert_row_32(const uint8_t *src, uint32_t *dst, const uint32_t *colors);
 
 static agnes_color_t g_colors[64] = {
     {0x7c, 0x7c, 0x7c, 0xff}, {0x00, 0x00, 0xfc, 0xff}, {0x00, 0x00, 0xbc, 0xff}, {0x44, 0x28, 0xbc, 0xff},
@@ -62,12 +73,30 @@ static agnes_color_t g_colors[64] = {
 };
 
 agnes_t* agnes_make(void) {
+    return agnes_make_with_config(NULL);
+}
+
+agnes_t* agnes_make_with_config(const agnes_config_t *config) {
     agnes_t *agnes = (agnes_t*)malloc(sizeof(*agnes));
     if (!agnes) {
         return NULL;
     }
     memset(agnes, 0, sizeof(*agnes));
     memset(agnes->ram, 0xff, sizeof(agnes->ram));
+    if (config) {
+        agnes->config = *config;
+    }
+    if (agnes->config.audio_sample_rate == 0) {
+        agnes->config.audio_sample_rate = APU_SAMPLE_RATE;
+    } else if (agnes->config.audio_sample_rate < APU_MIN_SAMPLE_RATE) {
+        agnes->config.audio_sample_rate = APU_MIN_SAMPLE_RATE;
+    } else if (agnes->config.audio_sample_rate > APU_MAX_SAMPLE_RATE) {
+        agnes->config.audio_sample_rate = APU_MAX_SAMPLE_RATE;
+    }
+    if (!apu_create_stream(&agnes->apu)) {
+        free(agnes);
+        return NULL;
+    }
     return agnes;
 }
 
@@ -102,6 +131,20 @@ bool agnes_load_ines_data(agnes_t *agnes, void *data, size_t data_size) {
         return false;
     }
 
+    free(agnes->decode_cache);
+    agnes->static_code = NULL;
+    agnes->decode_cache = (decoded_instruction_t*)calloc(prg_rom_size, sizeof(decoded_instruction_t));
+    if (agnes->decode_cache == NULL) {
+        return false;
+    }
+
+    free(agnes->chr_cache);
+    unsigned chr_size = chr_rom_size > 0 ? chr_rom_size : (8 * 1024);
+    agnes->chr_cache = (chr_row_t*)calloc(chr_size / 2, sizeof(chr_row_t)); // 8 rows per 16 byte tile
+    if (agnes->chr_cache == NULL) {
+        return false;
+    }
+
     agnes->gamepack.data = (const uint8_t *)data;
     agnes->gamepack.prg_rom_offset = prg_rom_offset;
     agnes->gamepack.chr_rom_offset = chr_rom_offset;
@@ -110,14 +153,19 @@ bool agnes_load_ines_data(agnes_t *agnes, void *data, size_t data_size) {
     if (!ok) {
         return false;
     }
+    mapper_decode_chr(agnes);
 
+    ppu_init(&agnes->ppu, agnes); // before cpu_init, which maps CHR banks into the ppu
     cpu_init(&agnes->cpu, agnes);
-    ppu_init(&agnes->ppu, agnes);
     apu_init(&agnes->apu, agnes);
     
     return true;
 }
 
+bool agnes_set_static_code(agnes_t *agnes, const agnes_static_code_t *code) {
+    return blocks_set_static_code(agnes, code);
+}
+
 void agnes_set_input(agnes_t *agn, const agnes_input_t *input_1, const agnes_input_t *input_2) {
     if (input_1 != NULL) {
         agn->controllers[0].state = get_input_byte(input_1);
@@ -134,8 +182,25 @@ size_t agnes_state_size() {
 void agnes_dump_state(const agnes_t *agnes, agnes_state_t *out_res) {
     memmove(out_res, agnes, sizeof(agnes_t));
     out_res->agnes.gamepack.data = NULL;
+    out_res->agnes.decode_cache = NULL;
+    out_res->agnes.chr_cache = NULL;
+    out_res->agnes.static_code = NULL;
+    out_res->agnes.palette = NULL;
+    out_res->agnes.skip_rendering = false;
+    memset(&out_res->agnes.screen_changes, 0, sizeof(out_res->agnes.screen_changes));
+    memset(out_res->agnes.fusion_counts, 0, sizeof(out_res->agnes.fusion_counts));
+    memset(&out_res->agnes.config, 0, sizeof(out_res->agnes.config));
+    memset(&out_res->agnes.scheduler, 0, sizeof(out_res->agnes.scheduler)); // nothing is pending between ticks
     out_res->agnes.cpu.agnes = NULL;
+    memset(out_res->agnes.cpu.read_pages, 0, sizeof(out_res->agnes.cpu.read_pages));
+    memset(out_res->agnes.cpu.write_pages, 0, sizeof(out_res->agnes.cpu.write_pages));
+    memset(out_res->agnes.cpu.decoded_pages, 0, sizeof(out_res->agnes.cpu.decoded_pages));
     out_res->agnes.ppu.agnes = NULL;
+    memset(out_res->agnes.ppu.chr_pages, 0, sizeof(out_res->agnes.ppu.chr_pages));
+    memset(out_res->agnes.ppu.nametable_pages, 0, sizeof(out_res->agnes.ppu.nametable_pages));
+    out_res->agnes.apu.agnes = NULL;
+    out_res->agnes.apu.dmc.agnes = NULL;
+    memset(&out_res->agnes.apu.stream, 0, sizeof(out_res->agnes.apu.stream));
     switch (out_res->agnes.gamepack.mapper) {
         case 0: out_res->agnes.mapper.m0.agnes = NULL; break;
         case 1: out_res->agnes.mapper.m1.agnes = NULL; break;
@@ -146,34 +211,71 @@ void agnes_dump_state(const agnes_t *agnes, agnes_state_t *out_res) {
 
 bool agnes_restore_state(agnes_t *agnes, const agnes_state_t *state) {
     const uint8_t *gamepack_data = agnes->gamepack.data;
+    decoded_instruction_t *decode_cache = agnes->decode_cache;
+    chr_row_t *chr_cache = agnes->chr_cache;
+    agnes_config_t config = agnes->config;
+    const agnes_static_code_t *static_code = agnes->static_code;
+    const agnes_color_t *palette = agnes->palette;
+    bool skip_rendering = agnes->skip_rendering;
+    audio_stream_t audio_stream = agnes->apu.stream;
+    uint64_t fusion_counts[FUSIONS_MAX];
+    memcpy(fusion_counts, agnes->fusion_counts, sizeof(fusion_counts));
     memmove(agnes, state, sizeof(agnes_t));
     agnes->gamepack.data = gamepack_data;
+    agnes->decode_cache = decode_cache;
+    agnes->chr_cache = chr_cache;
+    agnes->config = config;
+    agnes->static_code = static_code;
+    agnes->palette = palette;
+    agnes->skip_rendering = skip_rendering;
+    memcpy(agnes->fusion_counts, fusion_counts, sizeof(fusion_counts));
     agnes->cpu.agnes = agnes;
     agnes->ppu.agnes = agnes;
+    agnes->apu.agnes = agnes;
+    agnes->apu.dmc.agnes = agnes;
+    agnes->apu.stream = audio_stream;
+    apu_set_sample_rate(&agnes->apu, agnes->config.audio_sample_rate);
     switch (agnes->gamepack.mapper) {
         case 0: agnes->mapper.m0.agnes = agnes; break;
         case 1: agnes->mapper.m1.agnes = agnes; break;
         case 2: agnes->mapper.m2.agnes = agnes; break;
         case 4: agnes->mapper.m4.agnes = agnes; break;
     }
+    mapper_decode_chr(agnes); // CHR-RAM contents come from the state
+    ppu_mark_screen_changed(&agnes->ppu); // so is the screen
+    cpu_reset_memory_map(&agnes->cpu);
     return true;
 }
 
 bool agnes_tick(agnes_t *agnes, bool *out_new_frame) {
-    int cpu_cycles = cpu_tick(&agnes->cpu);
-    if (cpu_cycles == 0) {
-        return false;
+    if (agnes->cpu.stall > 0) {
+        tick_stall(agnes, out_new_frame);
+        return true;
     }
 
-    int ppu_cycles = cpu_cycles * 3;
-    for (int i = 0; i < ppu_cycles; i++) {
-        ppu_tick(&agnes->ppu, out_new_frame);
+    if (agnes->config.skip_idle_loops && idle_run(agnes, out_new_frame) > 0) {
+        return true;
     }
+
+    if (agnes->config.cpu_mode == AGNES_CPU_MODE_SCHEDULED && scheduler_run(agnes, out_new_frame) > 0) {
+        return true;
+    }
+
+    int cpu_cycles = 0;
+    if (agnes->config.cpu_mode == AGNES_CPU_MODE_BLOCKS || agnes->static_code) {
+        cpu_cycles = blocks_run(agnes);
+    }
+    if (cpu_cycles == 0) {
+        cpu_cycles = cpu_tick(&agnes->cpu);
+        if (cpu_cycles == 0) {
+            return false;
+        }
+    }
+
+    ppu_run(&agnes->ppu, cpu_cycles * 3, out_new_frame);
     
     // Tick APU for each CPU cycle
-    for (int i = 0; i < cpu_cycles; i++) {
-        apu_tick(&agnes->apu);
-    }
+    apu_run(&agnes->apu, cpu_cycles);
     
     return true;
 }
@@ -195,13 +297,84 @@ bool agnes_next_frame(agnes_t *agnes) {
 agnes_color_t agnes_get_screen_pixel(const agnes_t *agnes, int x, int y) {
     int ix = (y * AGNES_SCREEN_WIDTH) + x;
     uint8_t color_ix = agnes->ppu.screen_buffer[ix];
-    return g_colors[color_ix & 0x3f];
+    return agnes_get_palette(agnes)[color_ix & 0x3f];
+}
+
+void agnes_get_screen_rgba(const agnes_t *agnes, void *dst, size_t stride, agnes_pixel_format_t format) {
+    const agnes_color_t *palette = agnes_get_palette(agnes);
+    uint32_t colors[64];
+    for (int i = 0; i < 64; i++) {
+        colors[i] = convert_color(palette[i], format);
+    }
+
+    for (int y = 0; y < AGNES_SCREEN_HEIGHT; y++) {
+        const uint8_t *src = agnes->ppu.screen_buffer + (y * AGNES_SCREEN_WIDTH);
+        uint8_t *row = (uint8_t*)dst + (y * stride);
+        if (format == AGNES_PIXEL_FORMAT_RGB565) {
+            uint16_t *dst_row = (uint16_t*)row;
+            for (int x = 0; x < AGNES_SCREEN_WIDTH; x++) {
+                dst_row[x] = (uint16_t)colors[src[x] & 0x3f];
+            }
+        } else {
+            convert_row_32(src, (uint32_t*)row, colors);
+        }
+    }
+}
+
+const uint8_t* agnes_get_screen_indices(const agnes_t *agnes) {
+    return agnes->ppu.screen_buffer;
+}
+
+const agnes_color_t* agnes_get_palette(const agnes_t *agnes) {
+    return agnes->palette ? agnes->palette : g_colors;
+}
+
+void agnes_set_palette(agnes_t *agnes, const agnes_color_t *palette) {
+    agnes->palette = palette;
+}
+
+void agnes_set_skip_rendering(agnes_t *agnes, bool skip) {
+    agnes->skip_rendering = skip;
+}
+
+const uint8_t* agnes_get_changed_lines(const agnes_t *agnes) {
+    return agnes->screen_changes.lines_changed;
+}
+
+const uint32_t* agnes_get_line_hashes(const agnes_t *agnes) {
+    return agnes->screen_changes.line_hashes;
+}
+
+int agnes_get_fusion_stats(const agnes_t *agnes, agnes_fusion_stat_t *out_stats, int max_count) {
+    int count = instruction_get_fusions_count() - 1; // without FUSION_NONE
+    for (int i = 0; i < count && i < max_count; i++) {
+        out_stats[i].name = instruction_get_fusion_name(i + 1);
+        out_stats[i].count = agnes->fusion_counts[i + 1];
+    }
+    return count;
 }
 
 void agnes_destroy(agnes_t *agnes) {
+    if (agnes) {
+        free(agnes->decode_cache);
+        free(agnes->chr_cache);
+        apu_destroy_stream(&agnes->apu);
+    }
     free(agnes);
 }
 
+int agnes_get_audio_sample_rate(const agnes_t *agnes) {
+    return agnes->config.audio_sample_rate;
+}
+
+int agnes_read_audio(agnes_t *agnes, int16_t *dst, int max_count) {
+    return apu_read_audio(&agnes->apu, dst, max_count);
+}
+
+bool agnes_set_audio_callback(agnes_t *agnes, agnes_audio_callback_t callback, int block_size, void *user_data) {
+    return apu_set_audio_callback(&agnes->apu, callback, block_size, user_data);
+}
+
 void agnes_get_audio_samples(const agnes_t *agnes, int16_t *samples, int count) {
     apu_get_audio_samples(&agnes->apu, samples, count);
 }
@@ -219,3 +392,55 @@ static uint8_t get_input_byte(const agnes_input_t* input) {
     return res;
 }
 
+// The CPU doesn't do anything while stalled by OAM DMA, so the whole stall is consumed at once.
+// It stops at the end of a frame like it would when ticking one cycle at a time.
+// Stalls up to the end of the frame, PPU runs in batches up to its next event and cycle by cycle
+// after that so that the stall stops on the cycle the frame ends.
+static void tick_stall(agnes_t *agnes, bool *out_new_frame) {
+    cpu_t *cpu = &agnes->cpu;
+    bool new_frame = false;
+    int cycles = 0;
+    while (cpu->stall > 0 && !new_frame) {
+        int batch = ppu_dots_until_event(&agnes->ppu) / 3;
+        if (batch < 1) {
+            batch = 1;
+        }
+        if ((uint32_t)batch > cpu->stall) {
+            batch = (int)cpu->stall;
+        }
+        ppu_run(&agnes->ppu, batch * 3, &new_frame);
+        cpu->stall -= batch;
+        cycles += batch;
+    }
+    apu_run(&agnes->apu, cycles);
+    if (new_frame) {
+        *out_new_frame = true;
+    }
+}
+
+static uint32_t convert_color(agnes_color_t c, agnes_pixel_format_t format) {
+    switch (format) {
+        case AGNES_PIXEL_FORMAT_RGBA8888: return ((uint32_t)c.r << 24) | (c.g << 16) | (c.b << 8) | c.a;
+        case AGNES_PIXEL_FORMAT_BGRA8888: return ((uint32_t)c.b << 24) | (c.g << 16) | (c.r << 8) | c.a;
+        case AGNES_PIXEL_FORMAT_ARGB8888: return ((uint32_t)c.a << 24) | (c.r << 16) | (c.g << 8) | c.b;
+        case AGNES_PIXEL_FORMAT_RGB565:   return ((c.r >> 3) << 11) | ((c.g >> 2) << 5) | (c.b >> 3);
+        default: return 0;
+    }
+}
+
+static void convert_row_32(const uint8_t *src, uint32_t *dst, const uint32_t *colors) {
+#if defined(__AVX2__)
+    // 8 pixels at a time, color indices widened to 32 bits and gathered from the converted palette
+    const __m256i mask = _mm256_set1_epi32(0x3f);
+    for (int x = 0; x < AGNES_SCREEN_WIDTH; x += 8) {
+        __m128i ixs_8 = _mm_loadl_epi64((const __m128i*)(src + x));
+        __m256i ixs = _mm256_and_si256(_mm256_cvtepu8_epi32(ixs_8), mask);
+        __m256i res = _mm256_i32gather_epi32((const int*)colors, ixs, 4);
+        _mm256_storeu_si256((__m256i*)(dst + x), res);
+    }
+#else
+    for (int x = 0; x < AGNES_SCREEN_WIDTH; x++) {
+        dst[x] = colors[src[x] & 0x3f];
+    }
+#endif
+}
@@ -14,6 +14,18 @@ typedef enum {
     INTERRUPT_IRQ = 2
 } cpu_interrupt_t;
 
+typedef struct decoded_instruction {
+    uint16_t operand;
+    uint8_t opcode;
+    uint8_t size; // 0 if not decoded yet
+    uint8_t block_flags; // see blocks.c, 0 if not analyzed yet
+    uint8_t max_cycles; // including page cross and taken branch penalties
+    uint8_t loop_flags; // see idle.c, 0 if not analyzed yet
+    uint8_t fusion; // sequence starting here run by one handler, see instructions.c
+    uint8_t fused_max_cycles;
+    uint16_t static_block; // 1-based index into agnes->static_code->blocks, 0 if none
+} decoded_instruction_t;
+
 typedef struct cpu {
     struct agnes *agnes;
     uint16_t pc;
@@ -22,18 +34,49 @@ typedef struct cpu {
     uint8_t x;
     uint8_t y;
     uint8_t flag_carry;
-    uint8_t flag_zero;
     uint8_t flag_dis_interrupt;
     uint8_t flag_decimal;
     uint8_t flag_overflow;
-    uint8_t flag_negative;
+    uint16_t zn_result; // Z and N flags are computed from it when needed, see CPU_FLAG_ZERO
     uint32_t stall;
     uint64_t cycles;
     cpu_interrupt_t interrupt;
+
+    // Host memory backing each 256 byte page of the address space.
+    // NULL means the page has side effects and has to go through the slow path.
+    const uint8_t *read_pages[256];
+    uint8_t *write_pages[256];
+
+    // Decode cache entries for pages mapped to PRG-ROM, NULL for everything else.
+    decoded_instruction_t *decoded_pages[256];
+
+    bool prg_ram_mapped; // all of $6000-$7FFF has write pages, kept up to date by cpu_map_memory
 } cpu_t;
 
+// Blocks of code generated by utils/recompile.py
+typedef struct {
+    unsigned prg_rom_offset;
+    int max_cycles;
+    bool writes_prg_ram; // only safe while $6000-$7FFF is mapped, see cpu_t.prg_ram_mapped
+    int (*run)(cpu_t *cpu);
+} static_block_t;
+
+typedef struct agnes_static_code {
+    uint32_t prg_rom_hash;
+    const static_block_t *blocks;
+    unsigned blocks_count;
+} agnes_static_code_t;
+
 /************************************ PPU ************************************/
 
+// One row of a pattern table tile, decoded on load and when CHR-RAM is written
+typedef struct chr_row {
+    uint16_t pixels; // 2 bit palette indices, leftmost pixel in the top bits
+    uint16_t pixels_flipped; // same row flipped horizontally
+    uint8_t lo;
+    uint8_t hi;
+} chr_row_t;
+
 typedef struct {
     uint8_t y_pos;
     uint8_t tile_num;
@@ -93,12 +136,16 @@ typedef struct ppu {
     } status;
 
     bool is_odd_frame;
+    bool line_deferred; // visible dots of the current line weren't rendered yet
 
     uint8_t oam_address;
     uint8_t oam_data[256];
     sprite_t sprites[8];
     int sprite_ixs[8];
     int sprite_ixs_count;
+
+    const chr_row_t *chr_pages[8]; // 1KB pattern table banks pointing into agnes->chr_cache
+    uint8_t *nametable_pages[4]; // $2000 - $2FFF in 1KB windows, depend on mirroring
 } ppu_t;
 
 /********************************** MAPPERS **********************************/
@@ -224,10 +271,26 @@ typedef enum {
 
 // Audio configuration constants
 typedef enum {
-    APU_SAMPLE_RATE = 44100,
-    APU_BUFFER_SIZE = 1024
+    APU_SAMPLE_RATE = 44100, // default
+    APU_MIN_SAMPLE_RATE = 8000,
+    APU_MAX_SAMPLE_RATE = 96000
 } apu_config_t;
 
+// Band-limited synthesis, see blip.c
+typedef enum {
+    BLIP_PHASE_BITS = 6,
+    BLIP_PHASES = 1 << BLIP_PHASE_BITS,
+    BLIP_KERNEL_WIDTH = 16,
+    BLIP_BUFFER_SIZE = 1024 // samples, enough for a frame counter step at APU_MAX_SAMPLE_RATE
+} blip_config_t;
+
+typedef struct blip {
+    uint32_t factor; // samples per clock, 32 bits fraction
+    uint32_t offset; // fraction of a sample carried over from the last frame
+    int32_t integrator;
+    int32_t deltas[BLIP_BUFFER_SIZE];
+} blip_t;
+
 // Square wave duty cycles
 typedef enum {
     APU_DUTY_12_5 = 0,  // 12.5% duty cycle
@@ -266,7 +329,7 @@ typedef struct {
     bool envelope_loop;
     
     // Output
-    int16_t output;
+    uint8_t output; // level as indexed in the mixer tables
 } square_channel_t;
 
 typedef struct {
@@ -287,7 +350,7 @@ typedef struct {
     uint8_t step_counter;
     
     // Output
-    int16_t output;
+    uint8_t output; // level as indexed in the mixer tables
 } triangle_channel_t;
 
 typedef struct {
@@ -314,7 +377,7 @@ typedef struct {
     bool envelope_loop;
     
     // Output
-    int16_t output;
+    uint8_t output; // level as indexed in the mixer tables
 } noise_channel_t;
 
 typedef struct {
@@ -337,9 +400,19 @@ typedef struct {
     uint16_t bytes_remaining;
     
     // Output
-    int16_t output;
+    uint8_t output; // level as indexed in the mixer tables
 } dmc_channel_t;
 
+typedef struct audio_stream {
+    int16_t *samples; // AGNES_AUDIO_BUFFER_SIZE ring, allocated with agnes_t
+    int16_t *block; // block_size samples passed to the callback
+    unsigned read_pos; // positions wrap around, write_pos - read_pos samples are buffered
+    unsigned write_pos;
+    agnes_audio_callback_t callback;
+    void *callback_data;
+    int block_size;
+} audio_stream_t;
+
 typedef struct apu {
     struct agnes *agnes;
     
@@ -361,23 +434,50 @@ typedef struct apu {
     uint8_t status;
     
     // Audio output
-    int16_t audio_buffer[APU_BUFFER_SIZE];
-    int audio_buffer_index;
-    int audio_buffer_size;
+    blip_t blip;
+    uint64_t audio_frame_start;
+    int16_t mix_level;
+    audio_stream_t stream; // not part of the state
     
     // Timing
     uint64_t cycles;
 } apu_t;
 
 /*********************************** AGNES ***********************************/
+
+#define FUSIONS_MAX 32
+
+typedef struct {
+    uint8_t lines_drawn[AGNES_SCREEN_HEIGHT]; // nonzero if pixels of the line changed in the frame being drawn
+    uint8_t lines_changed[AGNES_SCREEN_HEIGHT]; // same for the last finished frame
+    uint32_t line_hashes[AGNES_SCREEN_HEIGHT]; // of the last finished frame's color indices
+} screen_changes_t;
+
+typedef struct {
+    int pending_cycles; // CPU cycles the PPU and APU are behind, 0 between ticks
+    bool synced;
+    bool new_frame;
+    bool status_predicted;
+    int status_dots; // dots PPUSTATUS stays the same for after where the PPU is, valid if status_predicted
+} scheduler_t;
+
 typedef struct agnes {
     cpu_t cpu;
     ppu_t ppu;
     apu_t apu;
     uint8_t ram[2 * 1024];
     gamepack_t gamepack;
+    decoded_instruction_t *decode_cache; // one entry per PRG-ROM byte, not part of the state
+    chr_row_t *chr_cache; // one entry per tile row of CHR-ROM or CHR-RAM, not part of the state
+    agnes_config_t config; // not part of the state
+    const agnes_static_code_t *static_code; // not part of the state
+    const agnes_color_t *palette; // NULL for the default one, not part of the state
+    bool skip_rendering; // not part of the state
+    screen_changes_t screen_changes; // not part of the state
+    uint64_t fusion_counts[FUSIONS_MAX]; // not part of the state
     controller_t controllers[2];
     bool controllers_latch;
+    scheduler_t scheduler;
 
     union {
         mapper0_t m0;
@@ -1,13 +1,16 @@
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
 
 #ifndef AGNES_AMALGAMATED
 #include "apu.h"
+#include "blip.h"
 #include "common.h"
 #include "cpu.h"
 #endif
 
+// NTSC CPU clock, blip buffer times are in CPU cycles
+#define CPU_CLOCK_RATE 1789773
+
 // Square wave duty cycles (4-step patterns)
 static const uint8_t square_duty_cycles[4][8] = {
     {0, 1, 0, 0, 0, 0, 0, 0}, // 12.5%
@@ -27,48 +30,133 @@ static const uint16_t noise_periods[16] = {
     4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
 };
 
+// Nonlinear mixer outputs, indexed by square1 + square2 and 3 * triangle + 2 * noise + dmc levels.
+// Standard approximation of the NES mixer: 95.52 / (8128 / n + 100) and 163.67 / (24329 / n + 100),
+// scaled so that the loudest output is 32767.
+static const int16_t pulse_table[31] = {
+    0, 380, 752, 1114, 1468, 1814, 2152, 2482, 2805, 3120, 3429, 3731, 4027, 4316, 4599, 4876,
+    5148, 5414, 5675, 5930, 6181, 6426, 6667, 6903, 7135, 7363, 7586, 7805, 8020, 8231, 8438
+};
+
+static const int16_t tnd_table[203] = {
+    0, 220, 437, 653, 867, 1080, 1291, 1500, 1707, 1913, 2117, 2320, 2521, 2720, 2918, 3115,
+    3309, 3503, 3695, 3885, 4074, 4261, 4448, 4632, 4816, 4997, 5178, 5357, 5535, 5712, 5887, 6061,
+    6234, 6406, 6576, 6745, 6913, 7080, 7245, 7409, 7573, 7735, 7895, 8055, 8214, 8371, 8528, 8683,
+    8838, 8991, 9143, 9294, 9444, 9593, 9742, 9889, 10035, 10180, 10324, 10467, 10610, 10751, 10892, 11031,
+    11170, 11308, 11444, 11580, 11715, 11850, 11983, 12116, 12247, 12378, 12508, 12637, 12766, 12893, 13020, 13146,
+    13271, 13396, 13519, 13642, 13765, 13886, 14007, 14127, 14246, 14364, 14482, 14599, 14716, 14831, 14946, 15061,
+    15175, 15288, 15400, 15512, 15623, 15733, 15843, 15952, 16060, 16168, 16275, 16382, 16488, 16594, 16698, 16803,
+    16906, 17009, 17112, 17214, 17315, 17416, 17516, 17616, 17715, 17814, 17912, 18009, 18106, 18203, 18299, 18394,
+    18489, 18583, 18677, 18771, 18863, 18956, 19048, 19139, 19230, 19321, 19411, 19500, 19589, 19678, 19766, 19853,
+    19941, 20027, 20114, 20200, 20285, 20370, 20455, 20539, 20623, 20706, 20789, 20871, 20953, 21035, 21116, 21197,
+    21277, 21357, 21437, 21516, 21595, 21674, 21752, 21829, 21907, 21984, 22060, 22136, 22212, 22288, 22363, 22438,
+    22512, 22586, 22660, 22733, 22806, 22879, 22951, 23023, 23095, 23166, 23237, 23307, 23378, 23448, 23517, 23587,
+    23656, 23724, 23793, 23861, 23929, 23996, 24063, 24130, 24197, 24263, 24329
+};
+
 // Length counter table
 static const uint8_t length_counter_table[32] = {
     10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
     12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
 };
 
+enum {
+    CHANNEL_SQUARE1,
+    CHANNEL_SQUARE2,
+    CHANNEL_TRIANGLE,
+    CHANNEL_NOISE,
+    CHANNEL_DMC,
+    CHANNELS_COUNT
+};
+
+static void run_channels(apu_t *apu, int ticks);
+static bool is_channel_audible(apu_t *apu, int channel);
+static void step_channel(apu_t *apu, int channel);
+static uint16_t *get_channel_timer(apu_t *apu, int channel);
+static int get_channel_period(apu_t *apu, int channel);
+static void update_square_output(square_channel_t *channel);
+static void update_triangle_output(triangle_channel_t *triangle);
+static void update_noise_output(noise_channel_t *noise);
+static void update_mix_level(apu_t *apu, uint64_t cycle);
+static void end_audio_frame(apu_t *apu);
+static void write_stream(audio_stream_t *stream, const int16_t *samples, int count);
+
 void apu_init(apu_t *apu, agnes_t *agnes) {
+    audio_stream_t stream = apu->stream;
     memset(apu, 0, sizeof(*apu));
     apu->agnes = agnes;
+    apu->dmc.agnes = agnes;
     
     // Initialize shift register for noise channel
     apu->noise.shift_register = 1;
     
-    // Initialize audio buffer
-    apu->audio_buffer_index = 0;
-    apu->audio_buffer_size = 0;
+    // Initialize audio buffer, samples of the previous game are dropped
+    blip_init(&apu->blip, CPU_CLOCK_RATE, agnes->config.audio_sample_rate);
+    apu->stream = stream;
+    apu->stream.read_pos = apu->stream.write_pos;
 }
 
-void apu_tick(apu_t *apu) {
-    apu->cycles++;
-    
-    // APU runs at 1/2 CPU speed
-    if (apu->cycles % 2 == 0) {
-        apu_tick_square_channel(&apu->square1);
-        apu_tick_square_channel(&apu->square2);
-        apu_tick_triangle_channel(&apu->triangle);
-        apu_tick_noise_channel(&apu->noise);
-        apu_tick_dmc_channel(&apu->dmc);
-        
-        // Frame counter ticks every 7457 CPU cycles (14914 APU cycles)
-        if (apu->cycles % 14914 == 0) {
-            apu_tick_frame_counter(apu);
-        }
+bool apu_create_stream(apu_t *apu) {
+    memset(&apu->stream, 0, sizeof(apu->stream));
+    apu->stream.samples = (int16_t*)calloc(AGNES_AUDIO_BUFFER_SIZE, sizeof(int16_t));
+    return apu->stream.samples != NULL;
+}
+
+void apu_destroy_stream(apu_t *apu) {
+    free(apu->stream.samples);
+    free(apu->stream.block);
+    memset(&apu->stream, 0, sizeof(apu->stream));
+}
+
+// Restored states come with the blip buffer of whoever dumped them
+void apu_set_sample_rate(apu_t *apu, int sample_rate) {
+    blip_t blip;
+    blip_init(&blip, CPU_CLOCK_RATE, sample_rate);
+    if (blip.factor != apu->blip.factor) {
+        apu->blip = blip;
+        apu->mix_level = 0;
     }
-    
-    // Generate audio samples at 44.1kHz
-    // CPU runs at ~1.79MHz, so we need to generate samples every ~40.6 CPU cycles
-    if (apu->cycles % 81 == 0) {
-        int16_t sample = apu_mix_audio(apu);
-        if (apu->audio_buffer_index < APU_BUFFER_SIZE) {
-            apu->audio_buffer[apu->audio_buffer_index++] = sample;
-            apu->audio_buffer_size = apu->audio_buffer_index;
+}
+
+// Frame counter ticks every 7457 CPU cycles (14914 APU cycles)
+#define FRAME_COUNTER_PERIOD 14914
+
+// Same as ticking cycles CPU cycles one by one, batches end at frame counter steps. Without
+// audio only the DMC channel is stepped, it's the only one whose timer games can observe
+// (through its memory reads, IRQ and $4015).
+void apu_run(apu_t *apu, int cycles) {
+    agnes_audio_mode_t audio_mode = apu->agnes->config.audio_mode;
+    if (audio_mode == AGNES_AUDIO_MODE_OFF) {
+        apu->cycles += cycles;
+        return;
+    }
+
+    while (cycles > 0) {
+        int to_frame_counter = FRAME_COUNTER_PERIOD - (int)(apu->cycles % FRAME_COUNTER_PERIOD);
+        int batch = cycles;
+        if (to_frame_counter < batch) {
+            batch = to_frame_counter;
+        }
+
+        // APU runs at 1/2 CPU speed, on even cycles
+        int apu_ticks = (int)(((apu->cycles + batch) >> 1) - (apu->cycles >> 1));
+        if (apu_ticks > 0) {
+            if (audio_mode == AGNES_AUDIO_MODE_FULL) {
+                run_channels(apu, apu_ticks);
+            } else {
+                apu_run_dmc_channel(&apu->dmc, apu_ticks);
+            }
+        }
+        apu->cycles += batch;
+        cycles -= batch;
+
+        if (apu->cycles % FRAME_COUNTER_PERIOD == 0) {
+            apu_tick_frame_counter(apu);
+            if (audio_mode == AGNES_AUDIO_MODE_FULL) {
+                apu_update_outputs(apu);
+                update_mix_level(apu, apu->cycles);
+                end_audio_frame(apu);
+            }
         }
     }
 }
@@ -205,6 +293,11 @@ void apu_write_register(apu_t *apu, apu_register_t addr, uint8_t val) {
             // Invalid register address - ignore write
             break;
     }
+
+    if (apu->agnes->config.audio_mode == AGNES_AUDIO_MODE_FULL) {
+        apu_update_outputs(apu);
+        update_mix_level(apu, apu->cycles);
+    }
 }
 
 uint8_t apu_read_register(apu_t *apu, apu_register_t addr) {
@@ -231,90 +324,88 @@ uint8_t apu_read_register(apu_t *apu, apu_register_t addr) {
     }
 }
 
-void apu_get_audio_samples(const apu_t *apu, int16_t *samples, int count) {
-    int available = apu->audio_buffer_size;
-    int to_copy = (count < available) ? count : available;
-    
-    memcpy(samples, apu->audio_buffer, to_copy * sizeof(int16_t));
-    
-    // Fill remaining with silence
-    for (int i = to_copy; i < count; i++) {
-        samples[i] = 0;
+int apu_read_audio(apu_t *apu, int16_t *dst, int max_count) {
+    audio_stream_t *stream = &apu->stream;
+    int count = (int)(stream->write_pos - stream->read_pos);
+    if (count > max_count) {
+        count = max_count;
     }
+    for (int i = 0; i < count; i++) {
+        dst[i] = stream->samples[(stream->read_pos + i) % AGNES_AUDIO_BUFFER_SIZE];
+    }
+    stream->read_pos += count;
+    return count;
 }
 
-void apu_clear_audio_buffer(apu_t *apu) {
-    apu->audio_buffer_size = 0;
-    apu->audio_buffer_index = 0;
+void apu_get_audio_samples(const apu_t *apu, int16_t *samples, int count) {
+    const audio_stream_t *stream = &apu->stream;
+    int available = (int)(stream->write_pos - stream->read_pos);
+    for (int i = 0; i < count; i++) {
+        samples[i] = i < available ? stream->samples[(stream->read_pos + i) % AGNES_AUDIO_BUFFER_SIZE] : 0;
+    }
 }
 
-AGNES_INTERNAL void apu_tick_square_channel(square_channel_t *channel) {
-    if (channel->timer > 0) {
-        channel->timer--;
-    } else {
-        channel->timer = channel->timer_reload;
-        channel->duty_step = (channel->duty_step + 1) % 8;
+bool apu_set_audio_callback(apu_t *apu, agnes_audio_callback_t callback, int block_size, void *user_data) {
+    audio_stream_t *stream = &apu->stream;
+    if (callback == NULL) {
+        stream->callback = NULL;
+        stream->callback_data = NULL;
+        return true;
     }
-    
-    // Generate output
-    if (channel->length_counter > 0 && channel->timer_reload > 7) {
-        uint8_t duty_value = square_duty_cycles[channel->duty_cycle][channel->duty_step];
-        uint8_t volume = channel->use_constant_volume ? 
-                        channel->constant_volume : channel->volume;
-        
-        channel->output = duty_value ? (volume * 1000) : 0;
-    } else {
-        channel->output = 0;
+    if (block_size < 1 || block_size > AGNES_AUDIO_BUFFER_SIZE) {
+        return false;
     }
+    if (block_size != stream->block_size) {
+        int16_t *block = (int16_t*)malloc(block_size * sizeof(int16_t));
+        if (block == NULL) {
+            return false;
+        }
+        free(stream->block);
+        stream->block = block;
+        stream->block_size = block_size;
+    }
+    stream->callback = callback;
+    stream->callback_data = user_data;
+    return true;
 }
 
-AGNES_INTERNAL void apu_tick_triangle_channel(triangle_channel_t *channel) {
-    if (channel->timer > 0) {
-        channel->timer--;
-    } else {
-        channel->timer = channel->timer_reload;
-        if (channel->linear_counter > 0 && channel->length_counter > 0) {
-            channel->step_counter = (channel->step_counter + 1) % 32;
-        }
+// Number of timer reloads in ticks APU ticks, the timer is left where it'd be after them
+static unsigned run_timer(uint16_t *timer, uint16_t timer_reload, int ticks) {
+    if (ticks <= *timer) {
+        *timer -= ticks;
+        return 0;
     }
-    
-    // Generate output
-    if (channel->length_counter > 0 && channel->linear_counter > 0 && channel->timer_reload > 1) {
-        channel->output = (triangle_steps[channel->step_counter] - 7) * 200;
-    } else {
-        channel->output = 0;
+    unsigned rest = ticks - *timer - 1; // after the first reload
+    unsigned period = timer_reload + 1u;
+    *timer = (uint16_t)(timer_reload - (rest % period));
+    return 1 + (rest / period);
+}
+
+AGNES_INTERNAL void apu_run_square_channel(square_channel_t *channel, int ticks) {
+    unsigned steps = run_timer(&channel->timer, channel->timer_reload, ticks);
+    channel->duty_step = (channel->duty_step + steps) % 8;
+}
+
+AGNES_INTERNAL void apu_run_triangle_channel(triangle_channel_t *channel, int ticks) {
+    unsigned steps = run_timer(&channel->timer, channel->timer_reload, ticks);
+    if (channel->linear_counter > 0 && channel->length_counter > 0) {
+        channel->step_counter = (channel->step_counter + steps) % 32;
     }
 }
 
-AGNES_INTERNAL void apu_tick_noise_channel(noise_channel_t *channel) {
-    if (channel->timer > 0) {
-        channel->timer--;
-    } else {
-        channel->timer = channel->timer_reload;
-        
+AGNES_INTERNAL void apu_run_noise_channel(noise_channel_t *channel, int ticks) {
+    unsigned steps = run_timer(&channel->timer, channel->timer_reload, ticks);
+    for (unsigned i = 0; i < steps; i++) {
         // Update shift register
         uint16_t feedback = (channel->shift_register >> 0) ^ (channel->shift_register >> (channel->mode ? 6 : 1));
         channel->shift_register >>= 1;
         channel->shift_register |= (feedback & 1) << 14;
     }
-    
-    // Generate output
-    if (channel->length_counter > 0) {
-        uint8_t volume = channel->use_constant_volume ? 
-                        channel->constant_volume : channel->volume;
-        
-        channel->output = (channel->shift_register & 1) ? 0 : (volume * 1000);
-    } else {
-        channel->output = 0;
-    }
 }
 
-AGNES_INTERNAL void apu_tick_dmc_channel(dmc_channel_t *channel) {
-    if (channel->timer > 0) {
-        channel->timer--;
-    } else {
-        channel->timer = channel->timer_reload;
-        
+AGNES_INTERNAL void apu_run_dmc_channel(dmc_channel_t *channel, int ticks) {
+    unsigned steps = run_timer(&channel->timer, channel->timer_reload, ticks);
+    for (unsigned i = 0; i < steps; i++) {
         if (channel->bits_remaining > 0) {
             // Output current bit
             if (channel->shift_register & 1) {
@@ -348,8 +439,15 @@ AGNES_INTERNAL void apu_tick_dmc_channel(dmc_channel_t *channel) {
             }
         }
     }
-    
-    channel->output = (channel->output_level - 64) * 16;
+}
+
+// Outputs as of the last APU tick
+AGNES_INTERNAL void apu_update_outputs(apu_t *apu) {
+    update_square_output(&apu->square1);
+    update_square_output(&apu->square2);
+    update_triangle_output(&apu->triangle);
+    update_noise_output(&apu->noise);
+    apu->dmc.output = apu->dmc.output_level;
 }
 
 AGNES_INTERNAL void apu_tick_frame_counter(apu_t *apu) {
@@ -531,21 +629,205 @@ AGNES_INTERNAL void apu_update_sweeps(apu_t *apu) {
 }
 
 AGNES_INTERNAL int16_t apu_mix_audio(apu_t *apu) {
-    int32_t mixed = 0;
-    
-    // Mix all channels
-    mixed += apu->square1.output;
-    mixed += apu->square2.output;
-    mixed += apu->triangle.output;
-    mixed += apu->noise.output;
-    mixed += apu->dmc.output;
-    
-    // Apply some basic mixing (divide by number of channels)
-    mixed /= 5;
-    
-    // Clamp to 16-bit range
-    if (mixed > 32767) mixed = 32767;
-    if (mixed < -32768) mixed = -32768;
-    
-    return (int16_t)mixed;
-} 
\ No newline at end of file
+    int pulse = apu->square1.output + apu->square2.output;
+    int tnd = (3 * apu->triangle.output) + (2 * apu->noise.output) + apu->dmc.output;
+    return pulse_table[pulse] + tnd_table[tnd];
+}
+
+// Channels that can't change their output in a batch are stepped in bulk, the others are stepped
+// timer reload by timer reload in time order and every change of the mixed output goes to the
+// blip buffer with the cycle it happened on, so the audio doesn't depend on how the APU is run.
+static void run_channels(apu_t *apu, int ticks) {
+    uint64_t first_tick_cycle = (apu->cycles | 1) + 1;
+    int next_ticks[CHANNELS_COUNT];
+    bool audible[CHANNELS_COUNT];
+    for (int i = 0; i < CHANNELS_COUNT; i++) {
+        audible[i] = is_channel_audible(apu, i);
+        next_ticks[i] = *get_channel_timer(apu, i) + 1;
+    }
+
+    for (;;) {
+        int channel = 0;
+        int tick = ticks + 1; // earliest reload in the batch
+        for (int i = 0; i < CHANNELS_COUNT; i++) {
+            if (audible[i] && next_ticks[i] < tick) {
+                channel = i;
+                tick = next_ticks[i];
+            }
+        }
+        if (tick > ticks) {
+            break;
+        }
+        step_channel(apu, channel);
+        update_mix_level(apu, first_tick_cycle + (2 * (uint64_t)(tick - 1)));
+        next_ticks[channel] = tick + get_channel_period(apu, channel);
+    }
+
+    for (int i = 0; i < CHANNELS_COUNT; i++) {
+        if (audible[i]) {
+            *get_channel_timer(apu, i) = (uint16_t)(next_ticks[i] - ticks - 1);
+        }
+    }
+    if (!audible[CHANNEL_SQUARE1]) {
+        apu_run_square_channel(&apu->square1, ticks);
+    }
+    if (!audible[CHANNEL_SQUARE2]) {
+        apu_run_square_channel(&apu->square2, ticks);
+    }
+    if (!audible[CHANNEL_TRIANGLE]) {
+        apu_run_triangle_channel(&apu->triangle, ticks);
+    }
+    if (!audible[CHANNEL_NOISE]) {
+        apu_run_noise_channel(&apu->noise, ticks);
+    }
+    if (!audible[CHANNEL_DMC]) {
+        apu_run_dmc_channel(&apu->dmc, ticks);
+    }
+    apu_update_outputs(apu);
+}
+
+// Whether stepping the channel's timer in the next batch can change its output
+static bool is_channel_audible(apu_t *apu, int channel) {
+    switch (channel) {
+        case CHANNEL_SQUARE1:
+        case CHANNEL_SQUARE2: {
+            square_channel_t *square = channel == CHANNEL_SQUARE1 ? &apu->square1 : &apu->square2;
+            uint8_t volume = square->use_constant_volume ? square->constant_volume : square->volume;
+            return square->length_counter > 0 && square->timer_reload > 7 && volume > 0;
+        }
+        case CHANNEL_TRIANGLE: {
+            triangle_channel_t *triangle = &apu->triangle;
+            return triangle->length_counter > 0 && triangle->linear_counter > 0 && triangle->timer_reload > 1;
+        }
+        case CHANNEL_NOISE: {
+            noise_channel_t *noise = &apu->noise;
+            uint8_t volume = noise->use_constant_volume ? noise->constant_volume : noise->volume;
+            return noise->length_counter > 0 && volume > 0;
+        }
+        case CHANNEL_DMC:
+            return apu->dmc.bits_remaining > 0 || apu->dmc.bytes_remaining > 0;
+        default:
+            return false;
+    }
+}
+
+static uint16_t *get_channel_timer(apu_t *apu, int channel) {
+    switch (channel) {
+        case CHANNEL_SQUARE1: return &apu->square1.timer;
+        case CHANNEL_SQUARE2: return &apu->square2.timer;
+        case CHANNEL_TRIANGLE: return &apu->triangle.timer;
+        case CHANNEL_NOISE: return &apu->noise.timer;
+        default: return &apu->dmc.timer;
+    }
+}
+
+// APU ticks between timer reloads
+static int get_channel_period(apu_t *apu, int channel) {
+    switch (channel) {
+        case CHANNEL_SQUARE1: return apu->square1.timer_reload + 1;
+        case CHANNEL_SQUARE2: return apu->square2.timer_reload + 1;
+        case CHANNEL_TRIANGLE: return apu->triangle.timer_reload + 1;
+        case CHANNEL_NOISE: return apu->noise.timer_reload + 1;
+        default: return apu->dmc.timer_reload + 1;
+    }
+}
+
+// One timer reload of the channel, the timer itself is left to the caller
+static void step_channel(apu_t *apu, int channel) {
+    switch (channel) {
+        case CHANNEL_SQUARE1:
+            apu->square1.duty_step = (apu->square1.duty_step + 1) % 8;
+            update_square_output(&apu->square1);
+            break;
+        case CHANNEL_SQUARE2:
+            apu->square2.duty_step = (apu->square2.duty_step + 1) % 8;
+            update_square_output(&apu->square2);
+            break;
+        case CHANNEL_TRIANGLE:
+            apu->triangle.step_counter = (apu->triangle.step_counter + 1) % 32;
+            update_triangle_output(&apu->triangle);
+            break;
+        case CHANNEL_NOISE:
+            apu->noise.timer = 0;
+            apu_run_noise_channel(&apu->noise, 1);
+            update_noise_output(&apu->noise);
+            break;
+        case CHANNEL_DMC:
+            apu->dmc.timer = 0;
+            apu_run_dmc_channel(&apu->dmc, 1);
+            apu->dmc.output = apu->dmc.output_level;
+            break;
+    }
+}
+
+static void update_square_output(square_channel_t *channel) {
+    if (channel->length_counter > 0 && channel->timer_reload > 7) {
+        uint8_t duty_value = square_duty_cycles[channel->duty_cycle][channel->duty_step];
+        uint8_t volume = channel->use_constant_volume ? 
+                        channel->constant_volume : channel->volume;
+        
+        channel->output = duty_value ? volume : 0;
+    } else {
+        channel->output = 0;
+    }
+}
+
+// Silenced triangle holds its step, ultrasonic periods average out to the middle
+static void update_triangle_output(triangle_channel_t *triangle) {
+    if (triangle->timer_reload > 1) {
+        triangle->output = triangle_steps[triangle->step_counter];
+    } else {
+        triangle->output = 7;
+    }
+}
+
+static void update_noise_output(noise_channel_t *noise) {
+    if (noise->length_counter > 0) {
+        uint8_t volume = noise->use_constant_volume ? 
+                        noise->constant_volume : noise->volume;
+        
+        noise->output = (noise->shift_register & 1) ? 0 : volume;
+    } else {
+        noise->output = 0;
+    }
+}
+
+// Adds a step to the blip buffer if the mixed output at cycle is different from the last one,
+// channel outputs have to be up to date
+static void update_mix_level(apu_t *apu, uint64_t cycle) {
+    int16_t level = apu_mix_audio(apu);
+    if (level != apu->mix_level) {
+        blip_add_delta(&apu->blip, (unsigned)(cycle - apu->audio_frame_start), level - apu->mix_level);
+        apu->mix_level = level;
+    }
+}
+
+// Audio frames end with frame counter steps
+static void end_audio_frame(apu_t *apu) {
+    int16_t samples[BLIP_BUFFER_SIZE];
+    unsigned duration = (unsigned)(apu->cycles - apu->audio_frame_start);
+    int count = blip_end_frame(&apu->blip, duration, samples, BLIP_BUFFER_SIZE);
+    apu->audio_frame_start = apu->cycles;
+    if (apu->stream.samples != NULL) {
+        write_stream(&apu->stream, samples, count);
+    }
+}
+
+// Overwrites the oldest samples when the ring is full, then passes full blocks to the callback
+static void write_stream(audio_stream_t *stream, const int16_t *samples, int count) {
+    for (int i = 0; i < count; i++) {
+        stream->samples[stream->write_pos % AGNES_AUDIO_BUFFER_SIZE] = samples[i];
+        stream->write_pos++;
+    }
+    if ((stream->write_pos - stream->read_pos) > AGNES_AUDIO_BUFFER_SIZE) {
+        stream->read_pos = stream->write_pos - AGNES_AUDIO_BUFFER_SIZE;
+    }
+
+    while (stream->callback != NULL && (int)(stream->write_pos - stream->read_pos) >= stream->block_size) {
+        for (int i = 0; i < stream->block_size; i++) {
+            stream->block[i] = stream->samples[(stream->read_pos + i) % AGNES_AUDIO_BUFFER_SIZE];
+        }
+        stream->read_pos += stream->block_size;
+        stream->callback(stream->callback_data, stream->block, stream->block_size);
+    }
+}
@@ -8,17 +8,22 @@
 
 // Function declarations
 void apu_init(apu_t *apu, agnes_t *agnes);
-void apu_tick(apu_t *apu);
+bool apu_create_stream(apu_t *apu);
+void apu_destroy_stream(apu_t *apu);
+void apu_set_sample_rate(apu_t *apu, int sample_rate);
+void apu_run(apu_t *apu, int cycles);
 void apu_write_register(apu_t *apu, apu_register_t addr, uint8_t val);
 uint8_t apu_read_register(apu_t *apu, apu_register_t addr);
+int apu_read_audio(apu_t *apu, int16_t *dst, int max_count);
 void apu_get_audio_samples(const apu_t *apu, int16_t *samples, int count);
-void apu_clear_audio_buffer(apu_t *apu);
+bool apu_set_audio_callback(apu_t *apu, agnes_audio_callback_t callback, int block_size, void *user_data);
 
 // Internal functions
-AGNES_INTERNAL void apu_tick_square_channel(square_channel_t *channel);
-AGNES_INTERNAL void apu_tick_triangle_channel(triangle_channel_t *channel);
-AGNES_INTERNAL void apu_tick_noise_channel(noise_channel_t *channel);
-AGNES_INTERNAL void apu_tick_dmc_channel(dmc_channel_t *channel);
+AGNES_INTERNAL void apu_run_square_channel(square_channel_t *channel, int ticks);
+AGNES_INTERNAL void apu_run_triangle_channel(triangle_channel_t *channel, int ticks);
+AGNES_INTERNAL void apu_run_noise_channel(noise_channel_t *channel, int ticks);
+AGNES_INTERNAL void apu_run_dmc_channel(dmc_channel_t *channel, int ticks);
+AGNES_INTERNAL void apu_update_outputs(apu_t *apu);
 AGNES_INTERNAL void apu_tick_frame_counter(apu_t *apu);
 AGNES_INTERNAL void apu_update_length_counters(apu_t *apu);
 AGNES_INTERNAL void apu_update_envelopes(apu_t *apu);
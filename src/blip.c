@@ -0,0 +1,127 @@
+#include <string.h>
+
+#ifndef AGNES_AMALGAMATED
+#include "blip.h"
+#endif
+
+// Band-limited synthesis: amplitude changes are added as band-limited steps at their exact time
+// (differentiated, so a step only touches BLIP_KERNEL_WIDTH samples) and samples are made by
+// integrating the buffer when a frame ends. Times are in clocks since the start of the frame.
+
+#define BLIP_UNIT_BITS 14
+#define BLIP_UNIT (1 << BLIP_UNIT_BITS)
+
+// Steps at every phase between two samples: Hann windowed sinc cut off at 0.9 of half the sample
+// rate, tap i of phase p is at x = i - 7 - p / 64. Taps of each phase add up to exactly BLIP_UNIT,
+// rounding error goes to the largest one, so that steps settle at their amplitude without drifting.
+static const int16_t blip_kernel[BLIP_PHASES][BLIP_KERNEL_WIDTH] = {
+    {23, -121, 322, -620, 972, -1308, 1550, 14748, 1550, -1308, 972, -620, 322, -121, 23, 0},
+    {23, -121, 318, -604, 932, -1215, 1316, 14741, 1790, -1401, 1012, -635, 326, -121, 23, 0},
+    {23, -120, 313, -588, 890, -1121, 1087, 14726, 2034, -1493, 1050, -648, 329, -121, 23, 0},
+    {23, -119, 308, -571, 847, -1027, 862, 14704, 2282, -1584, 1087, -661, 331, -121, 23, 0},
+    {22, -118, 302, -552, 803, -932, 644, 14667, 2535, -1673, 1123, -672, 333, -120, 22, 0},
+    {22, -116, 295, -533, 758, -838, 431, 14624, 2791, -1761, 1156, -682, 334, -119, 22, 0},
+    {22, -114, 288, -514, 712, -744, 223, 14572, 3052, -1847, 1188, -691, 334, -118, 21, 0},
+    {21, -112, 281, -493, 666, -650, 22, 14506, 3316, -1931, 1218, -699, 334, -116, 21, 0},
+    {21, -110, 273, -472, 620, -557, -173, 14434, 3583, -2013, 1246, -706, 333, -115, 20, 0},
+    {20, -108, 265, -451, 573, -464, -362, 14352, 3853, -2093, 1272, -711, 331, -112, 19, 0},
+    {19, -105, 257, -429, 526, -373, -545, 14260, 4125, -2171, 1297, -714, 328, -110, 19, 0},
+    {19, -103, 248, -406, 478, -282, -721, 14158, 4401, -2245, 1318, -717, 325, -107, 18, 0},
+    {18, -100, 239, -383, 431, -193, -891, 14047, 4678, -2317, 1338, -717, 321, -103, 16, 0},
+    {18, -97, 229, -360, 383, -105, -1054, 13929, 4957, -2385, 1355, -717, 316, -100, 15, 0},
+    {17, -94, 220, -337, 336, -19, -1211, 13801, 5238, -2450, 1370, -715, 310, -96, 14, 0},
+    {16, -91, 210, -313, 289, 66, -1360, 13663, 5520, -2512, 1382, -711, 304, -91, 12, 0},
+    {15, -88, 200, -289, 242, 149, -1503, 13520, 5803, -2570, 1391, -706, 296, -87, 11, 0},
+    {15, -84, 189, -265, 195, 230, -1638, 13365, 6086, -2623, 1398, -699, 288, -82, 9, 0},
+    {14, -81, 179, -241, 149, 309, -1767, 13203, 6370, -2673, 1402, -690, 279, -76, 7, 0},
+    {13, -77, 169, -217, 104, 385, -1889, 13033, 6654, -2719, 1404, -680, 269, -70, 5, 0},
+    {13, -74, 158, -193, 59, 460, -2004, 12854, 6938, -2759, 1402, -669, 259, -64, 3, 1},
+    {12, -70, 147, -170, 15, 532, -2111, 12670, 7221, -2796, 1398, -655, 247, -58, 1, 1},
+    {11, -66, 137, -146, -29, 602, -2212, 12479, 7503, -2827, 1390, -641, 235, -51, -2, 1},
+    {10, -63, 126, -122, -71, 669, -2306, 12279, 7784, -2853, 1380, -624, 222, -44, -4, 1},
+    {10, -59, 115, -99, -113, 734, -2392, 12071, 8064, -2874, 1366, -606, 209, -37, -7, 2},
+    {9, -55, 105, -76, -153, 796, -2472, 11857, 8341, -2890, 1350, -586, 194, -29, -9, 2},
+    {8, -52, 94, -54, -193, 855, -2544, 11640, 8617, -2900, 1330, -565, 179, -21, -12, 2},
+    {8, -48, 83, -31, -231, 911, -2610, 11413, 8890, -2905, 1308, -542, 163, -13, -15, 3},
+    {7, -45, 73, -10, -269, 964, -2669, 11185, 9160, -2904, 1282, -517, 146, -4, -18, 3},
+    {6, -41, 63, 12, -304, 1015, -2721, 10945, 9427, -2896, 1253, -491, 129, 5, -21, 3},
+    {6, -38, 53, 33, -339, 1062, -2767, 10704, 9691, -2883, 1221, -464, 111, 14, -24, 4},
+    {5, -34, 43, 53, -372, 1106, -2806, 10459, 9951, -2864, 1186, -435, 92, 23, -27, 4},
+    {5, -31, 33, 73, -404, 1148, -2838, 10206, 10206, -2838, 1148, -404, 73, 33, -31, 5},
+    {4, -27, 23, 92, -435, 1186, -2864, 9951, 10459, -2806, 1106, -372, 53, 43, -34, 5},
+    {4, -24, 14, 111, -464, 1221, -2883, 9691, 10704, -2767, 1062, -339, 33, 53, -38, 6},
+    {3, -21, 5, 129, -491, 1253, -2896, 9427, 10945, -2721, 1015, -304, 12, 63, -41, 6},
+    {3, -18, -4, 146, -517, 1282, -2904, 9160, 11185, -2669, 964, -269, -10, 73, -45, 7},
+    {3, -15, -13, 163, -542, 1308, -2905, 8890, 11413, -2610, 911, -231, -31, 83, -48, 8},
+    {2, -12, -21, 179, -565, 1330, -2900, 8617, 11640, -2544, 855, -193, -54, 94, -52, 8},
+    {2, -9, -29, 194, -586, 1350, -2890, 8341, 11857, -2472, 796, -153, -76, 105, -55, 9},
+    {2, -7, -37, 209, -606, 1366, -2874, 8064, 12071, -2392, 734, -113, -99, 115, -59, 10},
+    {1, -4, -44, 222, -624, 1380, -2853, 7784, 12279, -2306, 669, -71, -122, 126, -63, 10},
+    {1, -2, -51, 235, -641, 1390, -2827, 7503, 12479, -2212, 602, -29, -146, 137, -66, 11},
+    {1, 1, -58, 247, -655, 1398, -2796, 7221, 12670, -2111, 532, 15, -170, 147, -70, 12},
+    {1, 3, -64, 259, -669, 1402, -2759, 6938, 12854, -2004, 460, 59, -193, 158, -74, 13},
+    {0, 5, -70, 269, -680, 1404, -2719, 6654, 13033, -1889, 385, 104, -217, 169, -77, 13},
+    {0, 7, -76, 279, -690, 1402, -2673, 6370, 13203, -1767, 309, 149, -241, 179, -81, 14},
+    {0, 9, -82, 288, -699, 1398, -2623, 6086, 13365, -1638, 230, 195, -265, 189, -84, 15},
+    {0, 11, -87, 296, -706, 1391, -2570, 5803, 13520, -1503, 149, 242, -289, 200, -88, 15},
+    {0, 12, -91, 304, -711, 1382, -2512, 5520, 13663, -1360, 66, 289, -313, 210, -91, 16},
+    {0, 14, -96, 310, -715, 1370, -2450, 5238, 13801, -1211, -19, 336, -337, 220, -94, 17},
+    {0, 15, -100, 316, -717, 1355, -2385, 4957, 13929, -1054, -105, 383, -360, 229, -97, 18},
+    {0, 16, -103, 321, -717, 1338, -2317, 4678, 14047, -891, -193, 431, -383, 239, -100, 18},
+    {0, 18, -107, 325, -717, 1318, -2245, 4401, 14158, -721, -282, 478, -406, 248, -103, 19},
+    {0, 19, -110, 328, -714, 1297, -2171, 4125, 14260, -545, -373, 526, -429, 257, -105, 19},
+    {0, 19, -112, 331, -711, 1272, -2093, 3853, 14352, -362, -464, 573, -451, 265, -108, 20},
+    {0, 20, -115, 333, -706, 1246, -2013, 3583, 14434, -173, -557, 620, -472, 273, -110, 21},
+    {0, 21, -116, 334, -699, 1218, -1931, 3316, 14506, 22, -650, 666, -493, 281, -112, 21},
+    {0, 21, -118, 334, -691, 1188, -1847, 3052, 14572, 223, -744, 712, -514, 288, -114, 22},
+    {0, 22, -119, 334, -682, 1156, -1761, 2791, 14624, 431, -838, 758, -533, 295, -116, 22},
+    {0, 22, -120, 333, -672, 1123, -1673, 2535, 14667, 644, -932, 803, -552, 302, -118, 22},
+    {0, 23, -121, 331, -661, 1087, -1584, 2282, 14704, 862, -1027, 847, -571, 308, -119, 23},
+    {0, 23, -121, 329, -648, 1050, -1493, 2034, 14726, 1087, -1121, 890, -588, 313, -120, 23},
+    {0, 23, -121, 326, -635, 1012, -1401, 1790, 14741, 1316, -1215, 932, -604, 318, -121, 23}
+};
+
+void blip_init(blip_t *blip, unsigned clock_rate, unsigned sample_rate) {
+    memset(blip, 0, sizeof(*blip));
+    blip->factor = (uint32_t)(((uint64_t)sample_rate << 32) / clock_rate);
+}
+
+void blip_add_delta(blip_t *blip, unsigned clock_time, int delta) {
+    uint64_t pos = ((uint64_t)clock_time * blip->factor) + blip->offset;
+    unsigned ix = (unsigned)(pos >> 32);
+    unsigned phase = (unsigned)(pos >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+    if (ix + BLIP_KERNEL_WIDTH > BLIP_BUFFER_SIZE) {
+        return; // frame longer than the buffer
+    }
+    const int16_t *kernel = blip_kernel[phase];
+    int32_t *deltas = blip->deltas + ix;
+    for (int i = 0; i < BLIP_KERNEL_WIDTH; i++) {
+        deltas[i] += delta * kernel[i];
+    }
+}
+
+// Makes samples for clock_duration clocks, the rest of the fraction of a sample carries over to the
+// next frame. Returns the number of samples written, samples that don't fit are dropped.
+int blip_end_frame(blip_t *blip, unsigned clock_duration, int16_t *out_samples, int max_count) {
+    uint64_t pos = ((uint64_t)clock_duration * blip->factor) + blip->offset;
+    int count = (int)(pos >> 32);
+    if (count > BLIP_BUFFER_SIZE - BLIP_KERNEL_WIDTH) {
+        count = BLIP_BUFFER_SIZE - BLIP_KERNEL_WIDTH;
+    }
+    blip->offset = (uint32_t)pos;
+
+    int written = 0;
+    for (int i = 0; i < count; i++) {
+        blip->integrator += blip->deltas[i];
+        int32_t sample = blip->integrator / BLIP_UNIT;
+        if (sample > 32767) sample = 32767;
+        if (sample < -32768) sample = -32768;
+        if (written < max_count) {
+            out_samples[written++] = (int16_t)sample;
+        }
+    }
+
+    memmove(blip->deltas, blip->deltas + count, (BLIP_BUFFER_SIZE - count) * sizeof(int32_t));
+    memset(blip->deltas + (BLIP_BUFFER_SIZE - count), 0, count * sizeof(int32_t));
+    return written;
+}
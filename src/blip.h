@@ -0,0 +1,13 @@
+#ifndef blip_h
+#define blip_h
+
+#ifndef AGNES_AMALGAMATED
+#include "common.h"
+#include "agnes_types.h"
+#endif
+
+AGNES_INTERNAL void blip_init(blip_t *blip, unsigned clock_rate, unsigned sample_rate);
+AGNES_INTERNAL void blip_add_delta(blip_t *blip, unsigned clock_time, int delta);
+AGNES_INTERNAL int blip_end_frame(blip_t *blip, unsigned clock_duration, int16_t *out_samples, int max_count);
+
+#endif /* blip_h */
@@ -0,0 +1,299 @@
+#ifndef AGNES_AMALGAMATED
+#include "blocks.h"
+
+#include "agnes_types.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "instructions.h"
+#endif
+
+// Block execution runs consecutive PRG-ROM instructions without ticking the PPU and APU in between
+// and then ticks them for all the cycles at once. It's exact as long as none of the instructions
+// can interact with them, so a block only contains instructions that don't access I/O registers or
+// mapper registers and it has to finish before the next PPU event that could trigger an interrupt.
+// Blocks end after a jump, branch, call or return so that control goes back to agnes_tick.
+// Code generated ahead of time by utils/recompile.py follows the same rules and is looked up by
+// the PRG-ROM offset of its first instruction. Common sequences of instructions in the same page
+// run with one fused handler (see FUSIONS in instructions.c) if they all fit in the block.
+
+enum {
+    BLOCK_FLAG_ANALYZED        = 1 << 0,
+    BLOCK_FLAG_SAFE            = 1 << 1,
+    BLOCK_FLAG_END             = 1 << 2,
+    BLOCK_FLAG_FUSION_ANALYZED = 1 << 3,
+    BLOCK_FLAG_FUSION_END      = 1 << 4,
+    BLOCK_FLAG_PRG_RAM         = 1 << 5, // safe only while PRG-RAM is mapped, it can be unmapped after analysis
+    BLOCK_FLAG_FUSION_PRG_RAM  = 1 << 6  // same for any instruction of the fusion
+};
+
+// DMC sample fetches are the only memory accesses not done by the CPU. Sample bytes are fetched at
+// most every 264 cycles, so with this limit a block sees at most one fetch and it's from ROM (checked
+// before entering the block), which can't be affected by instructions executed out of order.
+#define BLOCK_MAX_CYCLES 192
+
+static void analyze_instruction(decoded_instruction_t *decoded);
+static void analyze_fusion(cpu_t *cpu, uint16_t addr, decoded_instruction_t *decoded);
+static uint32_t hash_prg_rom(const gamepack_t *gamepack);
+static bool is_range_read_safe(uint16_t addr, uint16_t size);
+static uint8_t get_range_write_flags(uint16_t addr, uint16_t size);
+
+int blocks_run(agnes_t *agnes) {
+    cpu_t *cpu = &agnes->cpu;
+    if (cpu->stall > 0 || cpu->interrupt != INTERRPUT_NONE) {
+        return 0;
+    }
+
+    const dmc_channel_t *dmc = &agnes->apu.dmc;
+    if (dmc->bytes_remaining > 0 && dmc->current_address < 0x8000) {
+        return 0;
+    }
+
+    int max_cycles = ppu_dots_until_event(&agnes->ppu) / 3;
+    if (max_cycles > BLOCK_MAX_CYCLES) {
+        max_cycles = BLOCK_MAX_CYCLES;
+    }
+
+    int cycles = 0;
+    while (true) {
+        decoded_instruction_t *decoded = cpu_get_decoded_instruction(cpu, cpu->pc);
+        if (decoded == NULL) {
+            break;
+        }
+        if (decoded->static_block > 0) {
+            const static_block_t *block = &agnes->static_code->blocks[decoded->static_block - 1];
+            if ((cycles + block->max_cycles) <= max_cycles && (!block->writes_prg_ram || cpu->prg_ram_mapped)) {
+                int block_cycles = block->run(cpu);
+                cpu->cycles += block_cycles;
+                cycles += block_cycles;
+                break;
+            }
+        }
+        if (!(decoded->block_flags & BLOCK_FLAG_FUSION_ANALYZED)) {
+            if (!(decoded->block_flags & BLOCK_FLAG_ANALYZED)) {
+                analyze_instruction(decoded);
+            }
+            analyze_fusion(cpu, cpu->pc, decoded);
+        }
+        if (!(decoded->block_flags & BLOCK_FLAG_SAFE) || (cycles + decoded->max_cycles) > max_cycles) {
+            break;
+        }
+        if ((decoded->block_flags & BLOCK_FLAG_PRG_RAM) && !cpu->prg_ram_mapped) {
+            break;
+        }
+
+        bool fusion_safe = !(decoded->block_flags & BLOCK_FLAG_FUSION_PRG_RAM) || cpu->prg_ram_mapped;
+        if (decoded->fusion && fusion_safe && (cycles + decoded->fused_max_cycles) <= max_cycles) {
+            int fused_cycles = instruction_execute_fused(cpu, decoded->fusion, decoded);
+            cpu->cycles += fused_cycles;
+            cycles += fused_cycles;
+            agnes->fusion_counts[decoded->fusion]++;
+            if (decoded->block_flags & BLOCK_FLAG_FUSION_END) {
+                break;
+            }
+            continue;
+        }
+
+        int ins_cycles = instruction_execute(cpu, decoded->opcode, decoded->operand);
+        cpu->cycles += ins_cycles;
+        cycles += ins_cycles;
+
+        if (decoded->block_flags & BLOCK_FLAG_END) {
+            break;
+        }
+    }
+    return cycles;
+}
+
+bool blocks_set_static_code(agnes_t *agnes, const agnes_static_code_t *code) {
+    if (agnes->decode_cache == NULL) {
+        return false;
+    }
+
+    unsigned prg_rom_size = agnes->gamepack.prg_rom_banks_count * (16 * 1024);
+    if (code) {
+        if (code->prg_rom_hash != hash_prg_rom(&agnes->gamepack) || code->blocks_count > 0xffff) {
+            return false;
+        }
+        for (unsigned i = 0; i < code->blocks_count; i++) {
+            if (code->blocks[i].prg_rom_offset >= prg_rom_size) {
+                return false;
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < prg_rom_size; i++) {
+        agnes->decode_cache[i].static_block = 0;
+    }
+    if (code) {
+        for (unsigned i = 0; i < code->blocks_count; i++) {
+            agnes->decode_cache[code->blocks[i].prg_rom_offset].static_block = i + 1;
+        }
+    }
+    agnes->static_code = code;
+    return true;
+}
+
+// Flags don't depend on the current memory map, it can change while they're cached by ROM offset
+static void analyze_instruction(decoded_instruction_t *decoded) {
+    const instruction_t *ins = instruction_get(decoded->opcode);
+    uint16_t operand = decoded->operand;
+    bool writes = instruction_writes_memory(decoded->opcode);
+
+    bool safe = false;
+    uint8_t write_flags = 0;
+    switch (ins->mode) {
+        case ADDR_MODE_ACCUMULATOR:
+        case ADDR_MODE_IMMEDIATE:
+        case ADDR_MODE_IMPLIED:
+        case ADDR_MODE_RELATIVE:
+        case ADDR_MODE_ZERO_PAGE:
+        case ADDR_MODE_ZERO_PAGE_X:
+        case ADDR_MODE_ZERO_PAGE_Y: {
+            safe = true; // only ram and the instruction itself are accessed (stack included)
+            break;
+        }
+        case ADDR_MODE_ABSOLUTE: {
+            bool is_jump = decoded->opcode == 0x4c || decoded->opcode == 0x20; // JMP, JSR
+            if (writes) {
+                write_flags = get_range_write_flags(operand, 1);
+            }
+            safe = is_jump || (is_range_read_safe(operand, 1) && (!writes || (write_flags & BLOCK_FLAG_SAFE)));
+            break;
+        }
+        case ADDR_MODE_ABSOLUTE_X:
+        case ADDR_MODE_ABSOLUTE_Y: {
+            if (writes) {
+                write_flags = get_range_write_flags(operand, 0x100);
+            }
+            safe = is_range_read_safe(operand, 0x100) && (!writes || (write_flags & BLOCK_FLAG_SAFE));
+            break;
+        }
+        default: { // BRK, indirect addressing (address unknown)
+            safe = false;
+            break;
+        }
+    }
+    if (ins->operation == NULL) {
+        safe = false;
+    }
+
+    uint8_t flags = BLOCK_FLAG_ANALYZED;
+    if (safe) {
+        flags |= BLOCK_FLAG_SAFE | (write_flags & BLOCK_FLAG_PRG_RAM);
+    }
+    switch (decoded->opcode) {
+        case 0x4c: case 0x20: case 0x60: case 0x40: { // JMP, JSR, RTS, RTI
+            flags |= BLOCK_FLAG_END;
+            break;
+        }
+        default: {
+            if (ins->mode == ADDR_MODE_RELATIVE) {
+                flags |= BLOCK_FLAG_END;
+            }
+            break;
+        }
+    }
+
+    int max_cycles = ins->cycles;
+    if (ins->page_cross_cycle) {
+        max_cycles += 1;
+    }
+    if (ins->mode == ADDR_MODE_RELATIVE) {
+        max_cycles += 2;
+    }
+
+    decoded->max_cycles = max_cycles;
+    decoded->block_flags = flags;
+}
+
+// Finds a fusion made of safe instructions starting at addr, only the last one can end a block
+static void analyze_fusion(cpu_t *cpu, uint16_t addr, decoded_instruction_t *decoded) {
+    decoded->block_flags |= BLOCK_FLAG_FUSION_ANALYZED;
+    decoded->fusion = 0;
+    decoded->fused_max_cycles = 0;
+    if (!(decoded->block_flags & BLOCK_FLAG_SAFE) || (decoded->block_flags & BLOCK_FLAG_END)) {
+        return;
+    }
+
+    uint8_t opcodes[3];
+    int max_cycles[3];
+    bool end = false;
+    bool prg_ram[3];
+    int count = 0;
+    const decoded_instruction_t *current = decoded;
+    uint16_t current_addr = addr;
+    while (true) {
+        opcodes[count] = current->opcode;
+        max_cycles[count] = (count > 0 ? max_cycles[count - 1] : 0) + current->max_cycles;
+        prg_ram[count] = (count > 0 && prg_ram[count - 1]) || (current->block_flags & BLOCK_FLAG_PRG_RAM);
+        count++;
+        end = current->block_flags & BLOCK_FLAG_END;
+        if (end || count == 3) {
+            break;
+        }
+        current_addr += current->size;
+        if ((current_addr >> 8) != (addr >> 8)) {
+            break;
+        }
+        decoded_instruction_t *next = cpu_get_decoded_instruction(cpu, current_addr);
+        if (next == NULL) {
+            break;
+        }
+        if (!(next->block_flags & BLOCK_FLAG_ANALYZED)) {
+            analyze_instruction(next);
+        }
+        if (!(next->block_flags & BLOCK_FLAG_SAFE)) {
+            break;
+        }
+        current = next;
+    }
+
+    uint8_t fusion = instruction_find_fusion(opcodes, count);
+    if (fusion == 0) {
+        return;
+    }
+    int length = instruction_get_fusion_length(fusion);
+    decoded->fusion = fusion;
+    decoded->fused_max_cycles = max_cycles[length - 1];
+    if (prg_ram[length - 1]) {
+        decoded->block_flags |= BLOCK_FLAG_FUSION_PRG_RAM;
+    }
+    if (length == count && end) {
+        decoded->block_flags |= BLOCK_FLAG_FUSION_END;
+    }
+}
+
+// Reads have side effects only for PPU, APU and controller registers
+static bool is_range_read_safe(uint16_t addr, uint16_t size) {
+    unsigned first = addr;
+    unsigned last = addr + size - 1;
+    if (last > 0xffff) { // wraps around to zero page
+        return true;
+    }
+    return last < 0x2000 || first >= 0x4020;
+}
+
+// Writes are safe only if they end up in ram (banks can't be switched in the middle of a block).
+// Internal ram is always mapped, PRG-RAM has to be checked when the instruction runs.
+static uint8_t get_range_write_flags(uint16_t addr, uint16_t size) {
+    unsigned first = addr;
+    unsigned last = addr + size - 1;
+    if (last < 0x2000) {
+        return BLOCK_FLAG_SAFE;
+    }
+    if (first >= 0x6000 && last < 0x8000) {
+        return BLOCK_FLAG_SAFE | BLOCK_FLAG_PRG_RAM;
+    }
+    return 0;
+}
+
+// djb2, same as utils/recompile.py
+static uint32_t hash_prg_rom(const gamepack_t *gamepack) {
+    const uint8_t *prg_rom = gamepack->data + gamepack->prg_rom_offset;
+    unsigned prg_rom_size = gamepack->prg_rom_banks_count * (16 * 1024);
+    uint32_t hash = 5381;
+    for (unsigned i = 0; i < prg_rom_size; i++) {
+        hash = ((hash << 5) + hash) + prg_rom[i];
+    }
+    return hash;
+}
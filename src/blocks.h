@@ -0,0 +1,14 @@
+#ifndef blocks_h
+#define blocks_h
+
+#ifndef AGNES_AMALGAMATED
+#include "common.h"
+#endif
+
+typedef struct agnes agnes_t;
+typedef struct agnes_static_code agnes_static_code_t;
+
+AGNES_INTERNAL int blocks_run(agnes_t *agnes);
+AGNES_INTERNAL bool blocks_set_static_code(agnes_t *agnes, const agnes_static_code_t *code);
+
+#endif /* blocks_h */
@@ -11,6 +11,14 @@
 #define AGNES_INTERNAL
 #endif
 
+#if defined(_MSC_VER)
+#define AGNES_FORCE_INLINE __forceinline
+#elif defined(__GNUC__)
+#define AGNES_FORCE_INLINE inline __attribute__((always_inline))
+#else
+#define AGNES_FORCE_INLINE inline
+#endif
+
 #define AGNES_GET_BIT(byte, bit_ix) (((byte) >> (bit_ix)) & 1)
 
 #endif /* common_h */
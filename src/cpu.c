@@ -8,16 +8,18 @@
 #include "agnes_types.h"
 #include "instructions.h"
 #include "mapper.h"
+#include "scheduler.h"
 #endif
 
-static uint16_t cpu_read16_indirect_bug(cpu_t *cpu, uint16_t addr);
-static uint16_t get_instruction_operand(cpu_t *cpu, addr_mode_t mode, bool *out_pages_differ);
 static int handle_interrupt(cpu_t *cpu);
-static bool check_pages_differ(uint16_t a, uint16_t b);
+static uint8_t fetch_instruction(cpu_t *cpu, uint16_t *out_operand);
+static void cpu_write8_slow(cpu_t *cpu, uint16_t addr, uint8_t val);
+static uint8_t cpu_read8_slow(cpu_t *cpu, uint16_t addr);
 
 void cpu_init(cpu_t *cpu, agnes_t *agnes) {
     memset(cpu, 0, sizeof(cpu_t));
     cpu->agnes = agnes;
+    cpu_reset_memory_map(cpu);
     cpu->pc = cpu_read16(cpu, 0xfffc); // RESET
     cpu->sp = 0xfd;
     cpu_restore_flags(cpu, 0x24);
@@ -35,24 +37,14 @@ int cpu_tick(cpu_t *cpu) {
         cycles += handle_interrupt(cpu);
     }
 
-    uint8_t opcode = cpu_read8(cpu, cpu->pc);
-    instruction_t *ins = instruction_get(opcode);
-    if (ins->operation == NULL) {
+    uint16_t operand = 0;
+    uint8_t opcode = fetch_instruction(cpu, &operand);
+    int ins_cycles = instruction_execute(cpu, opcode, operand);
+    if (ins_cycles == 0) {
         return 0;
     }
-    
-    uint8_t ins_size = instruction_get_size(ins->mode);
-    bool page_crossed = false;
-    uint16_t addr = get_instruction_operand(cpu, ins->mode, &page_crossed);
-
-    cpu->pc += ins_size;
 
-    cycles += ins->cycles;
-    cycles += ins->operation(cpu, addr, ins->mode);
-
-    if (page_crossed && ins->page_cross_cycle) {
-        cycles += 1;
-    }
+    cycles += ins_cycles;
 
     cpu->cycles += cycles;
 
@@ -60,8 +52,7 @@ int cpu_tick(cpu_t *cpu) {
 }
 
 void cpu_update_zn_flags(cpu_t *cpu, uint8_t val) {
-    cpu->flag_zero = val == 0;
-    cpu->flag_negative = AGNES_GET_BIT(val, 7);
+    cpu->zn_result = val;
 }
 
 void cpu_stack_push8(cpu_t *cpu, uint8_t val) {
@@ -92,21 +83,20 @@ uint16_t cpu_stack_pop16(cpu_t *cpu) {
 uint8_t cpu_get_flags(const cpu_t *cpu) {
     uint8_t res = 0;
     res |= cpu->flag_carry         << 0;
-    res |= cpu->flag_zero          << 1;
+    res |= CPU_FLAG_ZERO(cpu)      << 1;
     res |= cpu->flag_dis_interrupt << 2;
     res |= cpu->flag_decimal       << 3;
     res |= cpu->flag_overflow      << 6;
-    res |= cpu->flag_negative      << 7;
+    res |= CPU_FLAG_NEGATIVE(cpu)  << 7;
     return res;
 }
 
 void cpu_restore_flags(cpu_t *cpu, uint8_t flags) {
     cpu->flag_carry         = AGNES_GET_BIT(flags, 0);
-    cpu->flag_zero          = AGNES_GET_BIT(flags, 1);
     cpu->flag_dis_interrupt = AGNES_GET_BIT(flags, 2);
     cpu->flag_decimal       = AGNES_GET_BIT(flags, 3);
     cpu->flag_overflow      = AGNES_GET_BIT(flags, 6);
-    cpu->flag_negative      = AGNES_GET_BIT(flags, 7);
+    cpu->zn_result          = (AGNES_GET_BIT(flags, 1) ^ 1) | (AGNES_GET_BIT(flags, 7) << 8);
 }
 
 void cpu_trigger_nmi(cpu_t *cpu) {
@@ -124,8 +114,128 @@ void cpu_set_dma_stall(cpu_t *cpu) {
 }
 
 void cpu_write8(cpu_t *cpu, uint16_t addr, uint8_t val) {
+    uint8_t *page = cpu->write_pages[addr >> 8];
+    if (page) {
+        page[addr & 0xff] = val;
+    } else {
+        cpu_write8_slow(cpu, addr, val);
+    }
+}
+
+uint8_t cpu_read8(cpu_t *cpu, uint16_t addr) {
+    const uint8_t *page = cpu->read_pages[addr >> 8];
+    if (page) {
+        return page[addr & 0xff];
+    }
+    return cpu_read8_slow(cpu, addr);
+}
+
+uint16_t cpu_read16(cpu_t *cpu, uint16_t addr) {
+    uint8_t lo = cpu_read8(cpu, addr);
+    uint8_t hi = cpu_read8(cpu, addr + 1);
+    return (hi << 8) | lo;
+}
+
+// addr and size have to be multiples of 256, NULL memory sends the pages to the slow path
+void cpu_map_memory(cpu_t *cpu, uint16_t addr, unsigned size, const uint8_t *read_mem, uint8_t *write_mem) {
+    unsigned first_page = addr >> 8;
+    unsigned pages_count = size >> 8;
+    for (unsigned i = 0; i < pages_count; i++) {
+        cpu->read_pages[first_page + i] = read_mem ? (read_mem + (i << 8)) : NULL;
+        cpu->write_pages[first_page + i] = write_mem ? (write_mem + (i << 8)) : NULL;
+        cpu->decoded_pages[first_page + i] = NULL;
+    }
+
+    if (first_page < 0x80 && (first_page + pages_count) > 0x60) {
+        cpu->prg_ram_mapped = true;
+        for (unsigned page = 0x60; page < 0x80; page++) {
+            if (cpu->write_pages[page] == NULL) {
+                cpu->prg_ram_mapped = false;
+                break;
+            }
+        }
+    }
+}
+
+// Has to be called after cpu_map_memory, which detaches the pages from the decode cache
+void cpu_map_decode_cache(cpu_t *cpu, uint16_t addr, unsigned size, decoded_instruction_t *decoded) {
+    unsigned first_page = addr >> 8;
+    unsigned pages_count = size >> 8;
+    for (unsigned i = 0; i < pages_count; i++) {
+        cpu->decoded_pages[first_page + i] = decoded ? (decoded + (i << 8)) : NULL;
+    }
+}
+
+void cpu_reset_memory_map(cpu_t *cpu) {
+    agnes_t *agnes = cpu->agnes;
+    memset(cpu->read_pages, 0, sizeof(cpu->read_pages));
+    memset(cpu->write_pages, 0, sizeof(cpu->write_pages));
+    memset(cpu->decoded_pages, 0, sizeof(cpu->decoded_pages));
+    cpu->prg_ram_mapped = false;
+    for (uint16_t addr = 0; addr < 0x2000; addr += sizeof(agnes->ram)) { // 2KB of ram mirrored up to 0x2000
+        cpu_map_memory(cpu, addr, sizeof(agnes->ram), agnes->ram, agnes->ram);
+    }
+    mapper_map_memory(agnes);
+}
+
+// PRG-ROM can't change, so instructions in it are decoded once and cached by ROM offset, which keeps
+// the cache valid across bank switches. Instructions crossing a page boundary aren't cached as the
+// next page can be switched independently. Returns NULL for everything that isn't cached (e.g. code in RAM).
+decoded_instruction_t* cpu_get_decoded_instruction(cpu_t *cpu, uint16_t addr) {
+    decoded_instruction_t *decoded = cpu->decoded_pages[addr >> 8];
+    if (decoded == NULL) {
+        return NULL;
+    }
+    decoded += addr & 0xff;
+    if (decoded->size == 0) {
+        uint8_t opcode = cpu_read8(cpu, addr);
+        uint8_t size = instruction_get_size(instruction_get(opcode)->mode);
+        if ((addr & 0xff) + size > 0x100) {
+            return NULL;
+        }
+        decoded->operand = instruction_fetch_operand(cpu, addr, opcode);
+        decoded->opcode = opcode;
+        decoded->size = size;
+    }
+    return decoded;
+}
+
+static uint8_t fetch_instruction(cpu_t *cpu, uint16_t *out_operand) {
+    const decoded_instruction_t *decoded = cpu_get_decoded_instruction(cpu, cpu->pc);
+    if (decoded) {
+        *out_operand = decoded->operand;
+        return decoded->opcode;
+    }
+    uint8_t opcode = cpu_read8(cpu, cpu->pc);
+    *out_operand = instruction_fetch_operand(cpu, cpu->pc, opcode);
+    return opcode;
+}
+
+static int handle_interrupt(cpu_t *cpu) {
+    uint16_t addr = 0;
+    if (cpu->interrupt == INTERRUPT_NMI) {
+        addr = 0xfffa;
+    } else if (cpu->interrupt == INTERRUPT_IRQ) {
+        addr = 0xfffe;
+    } else {
+        return 0;
+    }
+    cpu->interrupt = INTERRPUT_NONE;
+    cpu_stack_push16(cpu, cpu->pc);
+    uint8_t flags = cpu_get_flags(cpu);
+    cpu_stack_push8(cpu, flags | 0x20);
+    cpu->pc = cpu_read16(cpu, addr);
+    cpu->flag_dis_interrupt = true;
+    return 7;
+}
+
+static void cpu_write8_slow(cpu_t *cpu, uint16_t addr, uint8_t val) {
     agnes_t *agnes = cpu->agnes;
 
+    if (addr >= 0x2000 && addr != 0x4016) { // everything but ram and controllers
+        scheduler_catch_up(agnes);
+    }
+
     if (addr < 0x2000) {
         agnes->ram[addr & 0x7ff] = val;
     } else if (addr < 0x4000) {
@@ -149,11 +259,19 @@ void cpu_write8(cpu_t *cpu, uint16_t addr, uint8_t val) {
     }
 }
 
-uint8_t cpu_read8(cpu_t *cpu, uint16_t addr) {
+static uint8_t cpu_read8_slow(cpu_t *cpu, uint16_t addr) {
     agnes_t *agnes = cpu->agnes;
 
+    if (addr >= 0x2000 && addr < 0x4000 && (addr & 0x7) == 0x2 && scheduler_can_read_status(agnes)) {
+        return ppu_read_status(&agnes->ppu);
+    }
+
+    if (addr >= 0x2000 && addr < 0x4016) { // ppu and apu
+        scheduler_catch_up(agnes);
+    }
+
     uint8_t res = 0;
-    if (addr >= 0x4020) { // moved to top because it's the most common case
+    if (addr >= 0x4020) {
         res = mapper_read(agnes, addr);
     } else if (addr < 0x2000) {
         res = agnes->ram[addr & 0x7ff];
@@ -173,96 +291,3 @@ uint8_t cpu_read8(cpu_t *cpu, uint16_t addr) {
     }
     return res;
 }
-
-uint16_t cpu_read16(cpu_t *cpu, uint16_t addr) {
-    uint8_t lo = cpu_read8(cpu, addr);
-    uint8_t hi = cpu_read8(cpu, addr + 1);
-    return (hi << 8) | lo;
-}
-
-static uint16_t cpu_read16_indirect_bug(cpu_t *cpu, uint16_t addr) {
-    uint8_t lo = cpu_read8(cpu, addr);
-    uint8_t hi = cpu_read8(cpu, (addr & 0xff00) | ((addr + 1) & 0x00ff));
-    return (hi << 8) | lo;
-}
-
-static uint16_t get_instruction_operand(cpu_t *cpu, addr_mode_t mode, bool *out_pages_differ) {
-    *out_pages_differ = false;
-    switch (mode) {
-        case ADDR_MODE_ABSOLUTE: {
-            return cpu_read16(cpu, cpu->pc + 1);
-        }
-        case ADDR_MODE_ABSOLUTE_X: {
-            uint16_t addr = cpu_read16(cpu, cpu->pc + 1);
-            uint16_t res = addr + cpu->x;
-            *out_pages_differ = check_pages_differ(addr, res);
-            return res;
-        }
-        case ADDR_MODE_ABSOLUTE_Y: {
-            uint16_t addr = cpu_read16(cpu, cpu->pc + 1);
-            uint16_t res = addr + cpu->y;
-            *out_pages_differ = check_pages_differ(addr, res);
-            return res;
-        }
-        case ADDR_MODE_IMMEDIATE: {
-            return cpu->pc + 1;
-        }
-        case ADDR_MODE_INDIRECT: {
-            uint16_t addr = cpu_read16(cpu, cpu->pc + 1);
-            return cpu_read16_indirect_bug(cpu, addr);
-        }
-        case ADDR_MODE_INDIRECT_X: {
-            uint8_t addr = cpu_read8(cpu, (cpu->pc + 1));
-            return cpu_read16_indirect_bug(cpu, (addr + cpu->x) & 0xff);
-        }
-        case ADDR_MODE_INDIRECT_Y: {
-            uint8_t arg = cpu_read8(cpu, cpu->pc + 1);
-            uint16_t addr2 = cpu_read16_indirect_bug(cpu, arg);
-            uint16_t res = addr2 + cpu->y;
-            *out_pages_differ = check_pages_differ(addr2, res);
-            return res;
-        }
-        case ADDR_MODE_ZERO_PAGE: {
-            return cpu_read8(cpu, cpu->pc + 1);
-        }
-        case ADDR_MODE_ZERO_PAGE_X: {
-            return (cpu_read8(cpu, cpu->pc + 1) + cpu->x) & 0xff;
-        }
-        case ADDR_MODE_ZERO_PAGE_Y: {
-            return (cpu_read8(cpu, cpu->pc + 1) + cpu->y) & 0xff;
-        }
-        case ADDR_MODE_RELATIVE: {
-            uint8_t addr = cpu_read8(cpu, cpu->pc + 1);
-            if (addr < 0x80) {
-                return cpu->pc + addr + 2;
-            } else {
-                return cpu->pc + addr + 2 - 0x100;
-            }
-        }
-        default: {
-            return 0;
-        }
-    }
-}
-
-static int handle_interrupt(cpu_t *cpu) {
-    uint16_t addr = 0;
-    if (cpu->interrupt == INTERRUPT_NMI) {
-        addr = 0xfffa;
-    } else if (cpu->interrupt == INTERRUPT_IRQ) {
-        addr = 0xfffe;
-    } else {
-        return 0;
-    }
-    cpu->interrupt = INTERRPUT_NONE;
-    cpu_stack_push16(cpu, cpu->pc);
-    uint8_t flags = cpu_get_flags(cpu);
-    cpu_stack_push8(cpu, flags | 0x20);
-    cpu->pc = cpu_read16(cpu, addr);
-    cpu->flag_dis_interrupt = true;
-    return 7;
-}
-
-static bool check_pages_differ(uint16_t a, uint16_t b) {
-    return (0xff00 & a) != (0xff00 & b);
-}
@@ -7,6 +7,12 @@
 
 typedef struct agnes agnes_t;
 typedef struct cpu cpu_t;
+typedef struct decoded_instruction decoded_instruction_t;
+
+// Instructions only store the result that Z and N depend on. Bits 0-7 are the result, bit 8 forces
+// N for flag combinations that no result byte gives (BIT and restored flags).
+#define CPU_FLAG_ZERO(cpu) (((cpu)->zn_result & 0xff) == 0)
+#define CPU_FLAG_NEGATIVE(cpu) (((cpu)->zn_result & 0x180) != 0)
 
 AGNES_INTERNAL void cpu_init(cpu_t *cpu, agnes_t *agnes);
 AGNES_INTERNAL int cpu_tick(cpu_t *cpu);
@@ -23,5 +29,9 @@ AGNES_INTERNAL void cpu_trigger_irq(cpu_t *cpu);
 AGNES_INTERNAL void cpu_write8(cpu_t *cpu, uint16_t addr, uint8_t val);
 AGNES_INTERNAL uint8_t cpu_read8(cpu_t *cpu, uint16_t addr);
 AGNES_INTERNAL uint16_t cpu_read16(cpu_t *cpu, uint16_t addr);
+AGNES_INTERNAL void cpu_map_memory(cpu_t *cpu, uint16_t addr, unsigned size, const uint8_t *read_mem, uint8_t *write_mem);
+AGNES_INTERNAL void cpu_map_decode_cache(cpu_t *cpu, uint16_t addr, unsigned size, decoded_instruction_t *decoded);
+AGNES_INTERNAL void cpu_reset_memory_map(cpu_t *cpu);
+AGNES_INTERNAL decoded_instruction_t* cpu_get_decoded_instruction(cpu_t *cpu, uint16_t addr);
 
 #endif /* cpu_h */
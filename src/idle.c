@@ -0,0 +1,270 @@
+#ifndef AGNES_AMALGAMATED
+#include "idle.h"
+
+#include "agnes_types.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "instructions.h"
+#endif
+
+// Idle loops are short PRG-ROM loops that only read RAM, ROM or PPUSTATUS, e.g. BIT $2002/BPL or
+// LDA $xx/BEQ waiting for the NMI handler. One iteration is executed normally while recording
+// registers, PPUSTATUS and cycles before every instruction. If it ends in the state it started in,
+// the next iterations are identical, so they are replayed by only advancing the cycle counter and
+// running the PPU and APU, as many whole iterations at once as fit before the next PPU event or
+// PPUSTATUS change. Replay stops at the instruction boundary where an interrupt gets pending,
+// PPUSTATUS differs from the recording or a frame ends, leaving the CPU exactly where the
+// interpreter would be.
+
+enum {
+    LOOP_FLAG_ANALYZED = 1 << 0,
+    LOOP_FLAG_IDLE     = 1 << 1
+};
+
+#define IDLE_MAX_INSTRUCTIONS 8
+
+typedef struct {
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t acc;
+    uint8_t x;
+    uint8_t y;
+    uint8_t flags;
+    uint16_t zn_result; // kept as is, so that the state is the same as after interpreting
+} idle_regs_t;
+
+typedef struct {
+    idle_regs_t regs;
+    uint8_t ppu_status;
+    int cycles;
+} idle_step_t;
+
+static void analyze_loop(cpu_t *cpu, decoded_instruction_t *head);
+static bool is_read_idle(uint16_t addr, uint16_t size);
+static bool is_loop_end(const decoded_instruction_t *decoded);
+static void tick_devices(agnes_t *agnes, int cycles, bool *out_new_frame);
+static uint8_t get_ppu_status(ppu_t *ppu);
+static idle_regs_t save_regs(const cpu_t *cpu);
+static void restore_regs(cpu_t *cpu, const idle_regs_t *regs);
+static bool regs_equal(const idle_regs_t *a, const idle_regs_t *b);
+
+// Returns 0 if cpu isn't at the start of an idle loop, CPU cycles executed otherwise
+int idle_run(agnes_t *agnes, bool *out_new_frame) {
+    cpu_t *cpu = &agnes->cpu;
+    if (cpu->stall > 0 || cpu->interrupt != INTERRPUT_NONE) {
+        return 0;
+    }
+
+    decoded_instruction_t *head = cpu_get_decoded_instruction(cpu, cpu->pc);
+    if (head == NULL) {
+        return 0;
+    }
+    if (head->loop_flags == 0) {
+        analyze_loop(cpu, head);
+    }
+    if (!(head->loop_flags & LOOP_FLAG_IDLE)) {
+        return 0;
+    }
+
+    idle_step_t steps[IDLE_MAX_INSTRUCTIONS];
+    int steps_count = 0;
+    int cycles = 0;
+    idle_regs_t start = save_regs(cpu);
+    while (true) {
+        idle_step_t *step = &steps[steps_count++];
+        step->regs = save_regs(cpu);
+        step->ppu_status = get_ppu_status(&agnes->ppu);
+
+        const decoded_instruction_t *decoded = cpu_get_decoded_instruction(cpu, cpu->pc);
+        bool last = decoded == NULL || is_loop_end(decoded);
+        step->cycles = cpu_tick(cpu);
+        if (step->cycles == 0) {
+            return cycles;
+        }
+        cycles += step->cycles;
+        tick_devices(agnes, step->cycles, out_new_frame);
+        if (*out_new_frame || cpu->interrupt != INTERRPUT_NONE || cpu->stall > 0) {
+            return cycles;
+        }
+        if (last || steps_count == IDLE_MAX_INSTRUCTIONS) {
+            break;
+        }
+    }
+
+    idle_regs_t end = save_regs(cpu);
+    if (!regs_equal(&start, &end)) {
+        return cycles;
+    }
+
+    int loop_cycles = cycles;
+    bool same_status = true;
+    for (int i = 1; i < steps_count; i++) {
+        if (steps[i].ppu_status != steps[0].ppu_status) {
+            same_status = false;
+        }
+    }
+
+    // Registers are restored only where the replay stops, devices ticked in between don't depend on them
+    while (true) {
+        // Whole iterations ending before the PPU can interrupt the CPU, end the frame or change PPUSTATUS
+        // are replayed at once, the one in which that happens step by step to stop on the right instruction
+        if (same_status && cpu->interrupt == INTERRPUT_NONE && get_ppu_status(&agnes->ppu) == steps[0].ppu_status) {
+            int dots = ppu_dots_until_event(&agnes->ppu);
+            int status_dots = ppu_dots_until_status_change(&agnes->ppu) - 1;
+            if (status_dots < dots) {
+                dots = status_dots;
+            }
+            int iterations = dots / (3 * loop_cycles);
+            if (iterations > 0) {
+                int batch_cycles = iterations * loop_cycles;
+                cpu->cycles += batch_cycles;
+                cycles += batch_cycles;
+                tick_devices(agnes, batch_cycles, out_new_frame);
+            }
+        }
+
+        for (int i = 0; i < steps_count; i++) {
+            const idle_step_t *step = &steps[i];
+            if (cpu->interrupt != INTERRPUT_NONE || get_ppu_status(&agnes->ppu) != step->ppu_status) {
+                restore_regs(cpu, &step->regs);
+                return cycles;
+            }
+            cpu->cycles += step->cycles;
+            cycles += step->cycles;
+            tick_devices(agnes, step->cycles, out_new_frame);
+            if (*out_new_frame) {
+                restore_regs(cpu, (i + 1) < steps_count ? &steps[i + 1].regs : &start);
+                return cycles;
+            }
+        }
+    }
+}
+
+// A loop is a straight line of reads ending with a branch or jump back to its first instruction
+static void analyze_loop(cpu_t *cpu, decoded_instruction_t *head) {
+    head->loop_flags = LOOP_FLAG_ANALYZED;
+
+    uint16_t head_addr = cpu->pc;
+    uint16_t addr = head_addr;
+    for (int i = 0; i < IDLE_MAX_INSTRUCTIONS; i++) {
+        const decoded_instruction_t *decoded = cpu_get_decoded_instruction(cpu, addr);
+        if (decoded == NULL) {
+            return;
+        }
+        const instruction_t *ins = instruction_get(decoded->opcode);
+        if (ins->operation == NULL || instruction_writes_memory(decoded->opcode)) {
+            return;
+        }
+
+        if (ins->mode == ADDR_MODE_RELATIVE) {
+            uint16_t target = addr + decoded->size + (int8_t)decoded->operand;
+            if (target == head_addr) {
+                head->loop_flags |= LOOP_FLAG_IDLE;
+            }
+            return;
+        }
+
+        switch (decoded->opcode) {
+            case 0x4c: { // JMP
+                if (decoded->operand == head_addr) {
+                    head->loop_flags |= LOOP_FLAG_IDLE;
+                }
+                return;
+            }
+            case 0x00: case 0x20: case 0x40: case 0x60: case 0x6c: // BRK, JSR, RTI, RTS, JMP (indirect)
+            case 0x08: case 0x28: case 0x48: case 0x68: // PHP, PLP, PHA, PLA
+            case 0x58: case 0x78: { // CLI, SEI (interrupts are triggered depending on the I flag)
+                return;
+            }
+            default: {
+                break;
+            }
+        }
+
+        bool idle = false;
+        switch (ins->mode) {
+            case ADDR_MODE_ACCUMULATOR:
+            case ADDR_MODE_IMMEDIATE:
+            case ADDR_MODE_IMPLIED:
+            case ADDR_MODE_ZERO_PAGE:
+            case ADDR_MODE_ZERO_PAGE_X:
+            case ADDR_MODE_ZERO_PAGE_Y: {
+                idle = true;
+                break;
+            }
+            case ADDR_MODE_ABSOLUTE: {
+                idle = is_read_idle(decoded->operand, 1);
+                break;
+            }
+            case ADDR_MODE_ABSOLUTE_X:
+            case ADDR_MODE_ABSOLUTE_Y: {
+                idle = is_read_idle(decoded->operand, 0x100);
+                break;
+            }
+            default: { // indirect addressing (address unknown)
+                idle = false;
+                break;
+            }
+        }
+        if (!idle) {
+            return;
+        }
+        addr += decoded->size;
+    }
+}
+
+// Reads that return the same value until the CPU writes somewhere or PPUSTATUS changes.
+// Reading PPUSTATUS clears the vblank flag and the write toggle, which only matters the first time.
+static bool is_read_idle(uint16_t addr, uint16_t size) {
+    unsigned first = addr;
+    unsigned last = addr + size - 1;
+    if (last > 0xffff) {
+        return false;
+    }
+    if (last < 0x2000 || first >= 0x6000) { // ram, prg-ram and prg-rom
+        return true;
+    }
+    return size == 1 && first < 0x4000 && (first & 0x7) == 0x2;
+}
+
+static bool is_loop_end(const decoded_instruction_t *decoded) {
+    return decoded->opcode == 0x4c || instruction_get(decoded->opcode)->mode == ADDR_MODE_RELATIVE; // JMP or branch
+}
+
+static void tick_devices(agnes_t *agnes, int cycles, bool *out_new_frame) {
+    ppu_run(&agnes->ppu, cycles * 3, out_new_frame);
+    apu_run(&agnes->apu, cycles);
+}
+
+static uint8_t get_ppu_status(ppu_t *ppu) {
+    ppu_sync_line(ppu); // sprite 0 hit
+    return (ppu->status.sprite_overflow << 5) | (ppu->status.sprite_zero_hit << 6) | (ppu->status.in_vblank << 7);
+}
+
+static idle_regs_t save_regs(const cpu_t *cpu) {
+    idle_regs_t res;
+    res.pc = cpu->pc;
+    res.sp = cpu->sp;
+    res.acc = cpu->acc;
+    res.x = cpu->x;
+    res.y = cpu->y;
+    res.flags = cpu_get_flags(cpu);
+    res.zn_result = cpu->zn_result;
+    return res;
+}
+
+static void restore_regs(cpu_t *cpu, const idle_regs_t *regs) {
+    cpu->pc = regs->pc;
+    cpu->sp = regs->sp;
+    cpu->acc = regs->acc;
+    cpu->x = regs->x;
+    cpu->y = regs->y;
+    cpu_restore_flags(cpu, regs->flags);
+    cpu->zn_result = regs->zn_result;
+}
+
+static bool regs_equal(const idle_regs_t *a, const idle_regs_t *b) {
+    return a->pc == b->pc && a->sp == b->sp && a->acc == b->acc
+        && a->x == b->x && a->y == b->y && a->flags == b->flags && a->zn_result == b->zn_result;
+}
@@ -0,0 +1,12 @@
+#ifndef idle_h
+#define idle_h
+
+#ifndef AGNES_AMALGAMATED
+#include "common.h"
+#endif
+
+typedef struct agnes agnes_t;
+
+AGNES_INTERNAL int idle_run(agnes_t *agnes, bool *out_new_frame);
+
+#endif /* idle_h */
@@ -64,270 +64,337 @@ static int op_tya(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
 
 static int take_branch(cpu_t *cpu, uint16_t addr);
 
-#define INS(OPC, NAME, CYCLES, PCC, OP, MODE) { NAME, OPC, CYCLES, PCC, MODE, OP }
-#define INE(OPC) { "ILL", OPC, 1, false, ADDR_MODE_IMPLIED, NULL }
+static AGNES_FORCE_INLINE int execute(cpu_t *cpu, uint16_t operand, instruction_op_fn op, addr_mode_t mode, int cycles, bool page_cross_cycle);
+static uint16_t fetch_operand(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_FORCE_INLINE uint16_t resolve_address(cpu_t *cpu, addr_mode_t mode, uint16_t operand, bool *out_pages_differ);
+static uint16_t read16_indirect_bug(cpu_t *cpu, uint16_t addr);
+static bool check_pages_differ(uint16_t a, uint16_t b);
+
+// Every opcode is listed here exactly once. The list is expanded into the instructions table
+// and into the specialized handlers used by instruction_execute, so that both always agree.
+#define INSTRUCTIONS(INS, INE) \
+    INS(0x00, "BRK", 7, false, op_brk, ADDR_MODE_IMPLIED_BRK) \
+    INS(0x01, "ORA", 6, false, op_ora, ADDR_MODE_INDIRECT_X)  \
+    INE(0x02)                                                 \
+    INE(0x03)                                                 \
+    INE(0x04)                                                 \
+    INS(0x05, "ORA", 3, false, op_ora, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x06, "ASL", 5, false, op_asl, ADDR_MODE_ZERO_PAGE)   \
+    INE(0x07)                                                 \
+    INS(0x08, "PHP", 3, false, op_php, ADDR_MODE_IMPLIED)     \
+    INS(0x09, "ORA", 2, false, op_ora, ADDR_MODE_IMMEDIATE)   \
+    INS(0x0a, "ASL", 2, false, op_asl, ADDR_MODE_ACCUMULATOR) \
+    INE(0x0b)                                                 \
+    INE(0x0c)                                                 \
+    INS(0x0d, "ORA", 4, false, op_ora, ADDR_MODE_ABSOLUTE)    \
+    INS(0x0e, "ASL", 6, false, op_asl, ADDR_MODE_ABSOLUTE)    \
+    INE(0x0f)                                                 \
+    INS(0x10, "BPL", 2, true,  op_bpl, ADDR_MODE_RELATIVE)    \
+    INS(0x11, "ORA", 5, true,  op_ora, ADDR_MODE_INDIRECT_Y)  \
+    INE(0x12)                                                 \
+    INE(0x13)                                                 \
+    INE(0x14)                                                 \
+    INS(0x15, "ORA", 4, false, op_ora, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0x16, "ASL", 6, false, op_asl, ADDR_MODE_ZERO_PAGE_X) \
+    INE(0x17)                                                 \
+    INS(0x18, "CLC", 2, false, op_clc, ADDR_MODE_IMPLIED)     \
+    INS(0x19, "ORA", 4, true,  op_ora, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0x1a)                                                 \
+    INE(0x1b)                                                 \
+    INE(0x1c)                                                 \
+    INS(0x1d, "ORA", 4, true,  op_ora, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0x1e, "ASL", 7, false, op_asl, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0x1f)                                                 \
+    INS(0x20, "JSR", 6, false, op_jsr, ADDR_MODE_ABSOLUTE)    \
+    INS(0x21, "AND", 6, false, op_and, ADDR_MODE_INDIRECT_X)  \
+    INE(0x22)                                                 \
+    INE(0x23)                                                 \
+    INS(0x24, "BIT", 3, false, op_bit, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x25, "AND", 3, false, op_and, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x26, "ROL", 5, false, op_rol, ADDR_MODE_ZERO_PAGE)   \
+    INE(0x27)                                                 \
+    INS(0x28, "PLP", 4, false, op_plp, ADDR_MODE_IMPLIED)     \
+    INS(0x29, "AND", 2, false, op_and, ADDR_MODE_IMMEDIATE)   \
+    INS(0x2a, "ROL", 2, false, op_rol, ADDR_MODE_ACCUMULATOR) \
+    INE(0x2b)                                                 \
+    INS(0x2c, "BIT", 4, false, op_bit, ADDR_MODE_ABSOLUTE)    \
+    INS(0x2d, "AND", 4, false, op_and, ADDR_MODE_ABSOLUTE)    \
+    INS(0x2e, "ROL", 6, false, op_rol, ADDR_MODE_ABSOLUTE)    \
+    INE(0x2f)                                                 \
+    INS(0x30, "BMI", 2, true,  op_bmi, ADDR_MODE_RELATIVE)    \
+    INS(0x31, "AND", 5, true,  op_and, ADDR_MODE_INDIRECT_Y)  \
+    INE(0x32)                                                 \
+    INE(0x33)                                                 \
+    INE(0x34)                                                 \
+    INS(0x35, "AND", 4, false, op_and, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0x36, "ROL", 6, false, op_rol, ADDR_MODE_ZERO_PAGE_X) \
+    INE(0x37)                                                 \
+    INS(0x38, "SEC", 2, false, op_sec, ADDR_MODE_IMPLIED)     \
+    INS(0x39, "AND", 4, true,  op_and, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0x3a)                                                 \
+    INE(0x3b)                                                 \
+    INE(0x3c)                                                 \
+    INS(0x3d, "AND", 4, true,  op_and, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0x3e, "ROL", 7, false, op_rol, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0x3f)                                                 \
+    INS(0x40, "RTI", 6, false, op_rti, ADDR_MODE_IMPLIED)     \
+    INS(0x41, "EOR", 6, false, op_eor, ADDR_MODE_INDIRECT_X)  \
+    INE(0x42)                                                 \
+    INE(0x43)                                                 \
+    INE(0x44)                                                 \
+    INS(0x45, "EOR", 3, false, op_eor, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x46, "LSR", 5, false, op_lsr, ADDR_MODE_ZERO_PAGE)   \
+    INE(0x47)                                                 \
+    INS(0x48, "PHA", 3, false, op_pha, ADDR_MODE_IMPLIED)     \
+    INS(0x49, "EOR", 2, false, op_eor, ADDR_MODE_IMMEDIATE)   \
+    INS(0x4a, "LSR", 2, false, op_lsr, ADDR_MODE_ACCUMULATOR) \
+    INE(0x4b)                                                 \
+    INS(0x4c, "JMP", 3, false, op_jmp, ADDR_MODE_ABSOLUTE)    \
+    INS(0x4d, "EOR", 4, false, op_eor, ADDR_MODE_ABSOLUTE)    \
+    INS(0x4e, "LSR", 6, false, op_lsr, ADDR_MODE_ABSOLUTE)    \
+    INE(0x4f)                                                 \
+    INS(0x50, "BVC", 2, true,  op_bvc, ADDR_MODE_RELATIVE)    \
+    INS(0x51, "EOR", 5, true,  op_eor, ADDR_MODE_INDIRECT_Y)  \
+    INE(0x52)                                                 \
+    INE(0x53)                                                 \
+    INE(0x54)                                                 \
+    INS(0x55, "EOR", 4, false, op_eor, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0x56, "LSR", 6, false, op_lsr, ADDR_MODE_ZERO_PAGE_X) \
+    INE(0x57)                                                 \
+    INS(0x58, "CLI", 2, false, op_cli, ADDR_MODE_IMPLIED)     \
+    INS(0x59, "EOR", 4, true,  op_eor, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0x5a)                                                 \
+    INE(0x5b)                                                 \
+    INE(0x5c)                                                 \
+    INS(0x5d, "EOR", 4, true,  op_eor, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0x5e, "LSR", 7, false, op_lsr, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0x5f)                                                 \
+    INS(0x60, "RTS", 6, false, op_rts, ADDR_MODE_IMPLIED)     \
+    INS(0x61, "ADC", 6, false, op_adc, ADDR_MODE_INDIRECT_X)  \
+    INE(0x62)                                                 \
+    INE(0x63)                                                 \
+    INE(0x64)                                                 \
+    INS(0x65, "ADC", 3, false, op_adc, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x66, "ROR", 5, false, op_ror, ADDR_MODE_ZERO_PAGE)   \
+    INE(0x67)                                                 \
+    INS(0x68, "PLA", 4, false, op_pla, ADDR_MODE_IMPLIED)     \
+    INS(0x69, "ADC", 2, false, op_adc, ADDR_MODE_IMMEDIATE)   \
+    INS(0x6a, "ROR", 2, false, op_ror, ADDR_MODE_ACCUMULATOR) \
+    INE(0x6b)                                                 \
+    INS(0x6c, "JMP", 5, false, op_jmp, ADDR_MODE_INDIRECT)    \
+    INS(0x6d, "ADC", 4, false,  op_adc, ADDR_MODE_ABSOLUTE)   \
+    INS(0x6e, "ROR", 6, false, op_ror, ADDR_MODE_ABSOLUTE)    \
+    INE(0x6f)                                                 \
+    INS(0x70, "BVS", 2, true,  op_bvs, ADDR_MODE_RELATIVE)    \
+    INS(0x71, "ADC", 5, true,  op_adc, ADDR_MODE_INDIRECT_Y)  \
+    INE(0x72)                                                 \
+    INE(0x73)                                                 \
+    INE(0x74)                                                 \
+    INS(0x75, "ADC", 4, false, op_adc, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0x76, "ROR", 6, false, op_ror, ADDR_MODE_ZERO_PAGE_X) \
+    INE(0x77)                                                 \
+    INS(0x78, "SEI", 2, false, op_sei, ADDR_MODE_IMPLIED)     \
+    INS(0x79, "ADC", 4, true,  op_adc, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0x7a)                                                 \
+    INE(0x7b)                                                 \
+    INE(0x7c)                                                 \
+    INS(0x7d, "ADC", 4, true,  op_adc, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0x7e, "ROR", 7, false, op_ror, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0x7f)                                                 \
+    INE(0x80)                                                 \
+    INS(0x81, "STA", 6, false, op_sta, ADDR_MODE_INDIRECT_X)  \
+    INE(0x82)                                                 \
+    INE(0x83)                                                 \
+    INS(0x84, "STY", 3, false, op_sty, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x85, "STA", 3, false, op_sta, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x86, "STX", 3, false, op_stx, ADDR_MODE_ZERO_PAGE)   \
+    INE(0x87)                                                 \
+    INS(0x88, "DEY", 2, false, op_dey, ADDR_MODE_IMPLIED)     \
+    INE(0x89)                                                 \
+    INS(0x8a, "TXA", 2, false, op_txa, ADDR_MODE_IMPLIED)     \
+    INE(0x8b)                                                 \
+    INS(0x8c, "STY", 4, false, op_sty, ADDR_MODE_ABSOLUTE)    \
+    INS(0x8d, "STA", 4, false, op_sta, ADDR_MODE_ABSOLUTE)    \
+    INS(0x8e, "STX", 4, false, op_stx, ADDR_MODE_ABSOLUTE)    \
+    INE(0x8f)                                                 \
+    INS(0x90, "BCC", 2, true,  op_bcc, ADDR_MODE_RELATIVE)    \
+    INS(0x91, "STA", 6, false, op_sta, ADDR_MODE_INDIRECT_Y)  \
+    INE(0x92)                                                 \
+    INE(0x93)                                                 \
+    INS(0x94, "STY", 4, false, op_sty, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0x95, "STA", 4, false, op_sta, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0x96, "STX", 4, false, op_stx, ADDR_MODE_ZERO_PAGE_Y) \
+    INE(0x97)                                                 \
+    INS(0x98, "TYA", 2, false, op_tya, ADDR_MODE_IMPLIED)     \
+    INS(0x99, "STA", 5, false, op_sta, ADDR_MODE_ABSOLUTE_Y)  \
+    INS(0x9a, "TXS", 2, false, op_txs, ADDR_MODE_IMPLIED)     \
+    INE(0x9b)                                                 \
+    INE(0x9c)                                                 \
+    INS(0x9d, "STA", 5, false, op_sta, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0x9e)                                                 \
+    INE(0x9f)                                                 \
+    INS(0xa0, "LDY", 2, false, op_ldy, ADDR_MODE_IMMEDIATE)   \
+    INS(0xa1, "LDA", 6, false, op_lda, ADDR_MODE_INDIRECT_X)  \
+    INS(0xa2, "LDX", 2, false, op_ldx, ADDR_MODE_IMMEDIATE)   \
+    INE(0xa3)                                                 \
+    INS(0xa4, "LDY", 3, false, op_ldy, ADDR_MODE_ZERO_PAGE)   \
+    INS(0xa5, "LDA", 3, false, op_lda, ADDR_MODE_ZERO_PAGE)   \
+    INS(0xa6, "LDX", 3, false, op_ldx, ADDR_MODE_ZERO_PAGE)   \
+    INE(0xa7)                                                 \
+    INS(0xa8, "TAY", 2, false, op_tay, ADDR_MODE_IMPLIED)     \
+    INS(0xa9, "LDA", 2, false, op_lda, ADDR_MODE_IMMEDIATE)   \
+    INS(0xaa, "TAX", 2, false, op_tax, ADDR_MODE_IMPLIED)     \
+    INE(0xab)                                                 \
+    INS(0xac, "LDY", 4, false, op_ldy, ADDR_MODE_ABSOLUTE)    \
+    INS(0xad, "LDA", 4, false, op_lda, ADDR_MODE_ABSOLUTE)    \
+    INS(0xae, "LDX", 4, false, op_ldx, ADDR_MODE_ABSOLUTE)    \
+    INE(0xaf)                                                 \
+    INS(0xb0, "BCS", 2, true,  op_bcs, ADDR_MODE_RELATIVE)    \
+    INS(0xb1, "LDA", 5, true,  op_lda, ADDR_MODE_INDIRECT_Y)  \
+    INE(0xb2)                                                 \
+    INE(0xb3)                                                 \
+    INS(0xb4, "LDY", 4, false, op_ldy, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0xb5, "LDA", 4, false, op_lda, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0xb6, "LDX", 4, false, op_ldx, ADDR_MODE_ZERO_PAGE_Y) \
+    INE(0xb7)                                                 \
+    INS(0xb8, "CLV", 2, false, op_clv, ADDR_MODE_IMPLIED)     \
+    INS(0xb9, "LDA", 4, true,  op_lda, ADDR_MODE_ABSOLUTE_Y)  \
+    INS(0xba, "TSX", 2, false, op_tsx, ADDR_MODE_IMPLIED)     \
+    INE(0xbb)                                                 \
+    INS(0xbc, "LDY", 4, true,  op_ldy, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0xbd, "LDA", 4, true,  op_lda, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0xbe, "LDX", 4, true,  op_ldx, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0xbf)                                                 \
+    INS(0xc0, "CPY", 2, false, op_cpy, ADDR_MODE_IMMEDIATE)   \
+    INS(0xc1, "CMP", 6, false, op_cmp, ADDR_MODE_INDIRECT_X)  \
+    INE(0xc2)                                                 \
+    INE(0xc3)                                                 \
+    INS(0xc4, "CPY", 3, false, op_cpy, ADDR_MODE_ZERO_PAGE)   \
+    INS(0xc5, "CMP", 3, false, op_cmp, ADDR_MODE_ZERO_PAGE)   \
+    INS(0xc6, "DEC", 5, false, op_dec, ADDR_MODE_ZERO_PAGE)   \
+    INE(0xc7)                                                 \
+    INS(0xc8, "INY", 2, false, op_iny, ADDR_MODE_IMPLIED)     \
+    INS(0xc9, "CMP", 2, false, op_cmp, ADDR_MODE_IMMEDIATE)   \
+    INS(0xca, "DEX", 2, false, op_dex, ADDR_MODE_IMPLIED)     \
+    INE(0xcb)                                                 \
+    INS(0xcc, "CPY", 4, false, op_cpy, ADDR_MODE_ABSOLUTE)    \
+    INS(0xcd, "CMP", 4, false, op_cmp, ADDR_MODE_ABSOLUTE)    \
+    INS(0xce, "DEC", 6, false, op_dec, ADDR_MODE_ABSOLUTE)    \
+    INE(0xcf)                                                 \
+    INS(0xd0, "BNE", 2, true,  op_bne, ADDR_MODE_RELATIVE)    \
+    INS(0xd1, "CMP", 5, true,  op_cmp, ADDR_MODE_INDIRECT_Y)  \
+    INE(0xd2)                                                 \
+    INE(0xd3)                                                 \
+    INE(0xd4)                                                 \
+    INS(0xd5, "CMP", 4, false, op_cmp, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0xd6, "DEC", 6, false, op_dec, ADDR_MODE_ZERO_PAGE_X) \
+    INE(0xd7)                                                 \
+    INS(0xd8, "CLD", 2, false, op_cld, ADDR_MODE_IMPLIED)     \
+    INS(0xd9, "CMP", 4, true,  op_cmp, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0xda)                                                 \
+    INE(0xdb)                                                 \
+    INE(0xdc)                                                 \
+    INS(0xdd, "CMP", 4, true,  op_cmp, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0xde, "DEC", 7, false, op_dec, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0xdf)                                                 \
+    INS(0xe0, "CPX", 2, false, op_cpx, ADDR_MODE_IMMEDIATE)   \
+    INS(0xe1, "SBC", 6, false, op_sbc, ADDR_MODE_INDIRECT_X)  \
+    INE(0xe2)                                                 \
+    INE(0xe3)                                                 \
+    INS(0xe4, "CPX", 3, false, op_cpx, ADDR_MODE_ZERO_PAGE)   \
+    INS(0xe5, "SBC", 3, false, op_sbc, ADDR_MODE_ZERO_PAGE)   \
+    INS(0xe6, "INC", 5, false, op_inc, ADDR_MODE_ZERO_PAGE)   \
+    INE(0xe7)                                                 \
+    INS(0xe8, "INX", 2, false, op_inx, ADDR_MODE_IMPLIED)     \
+    INS(0xe9, "SBC", 2, false, op_sbc, ADDR_MODE_IMMEDIATE)   \
+    INS(0xea, "NOP", 2, false, op_nop, ADDR_MODE_IMPLIED)     \
+    INE(0xeb)                                                 \
+    INS(0xec, "CPX", 4, false, op_cpx, ADDR_MODE_ABSOLUTE)    \
+    INS(0xed, "SBC", 4, false, op_sbc, ADDR_MODE_ABSOLUTE)    \
+    INS(0xee, "INC", 6, false, op_inc, ADDR_MODE_ABSOLUTE)    \
+    INE(0xef)                                                 \
+    INS(0xf0, "BEQ", 2, true,  op_beq, ADDR_MODE_RELATIVE)    \
+    INS(0xf1, "SBC", 5, true,  op_sbc, ADDR_MODE_INDIRECT_Y)  \
+    INE(0xf2)                                                 \
+    INE(0xf3)                                                 \
+    INE(0xf4)                                                 \
+    INS(0xf5, "SBC", 4, false, op_sbc, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0xf6, "INC", 6, false, op_inc, ADDR_MODE_ZERO_PAGE_X) \
+    INE(0xf7)                                                 \
+    INS(0xf8, "SED", 2, false, op_sed, ADDR_MODE_IMPLIED)     \
+    INS(0xf9, "SBC", 4, true,  op_sbc, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0xfa)                                                 \
+    INE(0xfb)                                                 \
+    INE(0xfc)                                                 \
+    INS(0xfd, "SBC", 4, true,  op_sbc, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0xfe, "INC", 7, false, op_inc, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0xff)
+
+#define INS_TABLE_ENTRY(OPC, NAME, CYCLES, PCC, OP, MODE) { NAME, OPC, CYCLES, PCC, MODE, OP },
+#define INE_TABLE_ENTRY(OPC) { "ILL", OPC, 1, false, ADDR_MODE_IMPLIED, NULL },
 
 static instruction_t instructions[256] = {
-    INS(0x00, "BRK", 7, false, op_brk, ADDR_MODE_IMPLIED_BRK),
-    INS(0x01, "ORA", 6, false, op_ora, ADDR_MODE_INDIRECT_X),
-    INE(0x02),
-    INE(0x03),
-    INE(0x04),
-    INS(0x05, "ORA", 3, false, op_ora, ADDR_MODE_ZERO_PAGE),
-    INS(0x06, "ASL", 5, false, op_asl, ADDR_MODE_ZERO_PAGE),
-    INE(0x07),
-    INS(0x08, "PHP", 3, false, op_php, ADDR_MODE_IMPLIED),
-    INS(0x09, "ORA", 2, false, op_ora, ADDR_MODE_IMMEDIATE),
-    INS(0x0a, "ASL", 2, false, op_asl, ADDR_MODE_ACCUMULATOR),
-    INE(0x0b),
-    INE(0x0c),
-    INS(0x0d, "ORA", 4, false, op_ora, ADDR_MODE_ABSOLUTE),
-    INS(0x0e, "ASL", 6, false, op_asl, ADDR_MODE_ABSOLUTE),
-    INE(0x0f),
-    INS(0x10, "BPL", 2, true,  op_bpl, ADDR_MODE_RELATIVE),
-    INS(0x11, "ORA", 5, true,  op_ora, ADDR_MODE_INDIRECT_Y),
-    INE(0x12),
-    INE(0x13),
-    INE(0x14),
-    INS(0x15, "ORA", 4, false, op_ora, ADDR_MODE_ZERO_PAGE_X),
-    INS(0x16, "ASL", 6, false, op_asl, ADDR_MODE_ZERO_PAGE_X),
-    INE(0x17),
-    INS(0x18, "CLC", 2, false, op_clc, ADDR_MODE_IMPLIED),
-    INS(0x19, "ORA", 4, true,  op_ora, ADDR_MODE_ABSOLUTE_Y),
-    INE(0x1a),
-    INE(0x1b),
-    INE(0x1c),
-    INS(0x1d, "ORA", 4, true,  op_ora, ADDR_MODE_ABSOLUTE_X),
-    INS(0x1e, "ASL", 7, false, op_asl, ADDR_MODE_ABSOLUTE_X),
-    INE(0x1f),
-    INS(0x20, "JSR", 6, false, op_jsr, ADDR_MODE_ABSOLUTE),
-    INS(0x21, "AND", 6, false, op_and, ADDR_MODE_INDIRECT_X),
-    INE(0x22),
-    INE(0x23),
-    INS(0x24, "BIT", 3, false, op_bit, ADDR_MODE_ZERO_PAGE),
-    INS(0x25, "AND", 3, false, op_and, ADDR_MODE_ZERO_PAGE),
-    INS(0x26, "ROL", 5, false, op_rol, ADDR_MODE_ZERO_PAGE),
-    INE(0x27),
-    INS(0x28, "PLP", 4, false, op_plp, ADDR_MODE_IMPLIED),
-    INS(0x29, "AND", 2, false, op_and, ADDR_MODE_IMMEDIATE),
-    INS(0x2a, "ROL", 2, false, op_rol, ADDR_MODE_ACCUMULATOR),
-    INE(0x2b),
-    INS(0x2c, "BIT", 4, false, op_bit, ADDR_MODE_ABSOLUTE),
-    INS(0x2d, "AND", 4, false, op_and, ADDR_MODE_ABSOLUTE),
-    INS(0x2e, "ROL", 6, false, op_rol, ADDR_MODE_ABSOLUTE),
-    INE(0x2f),
-    INS(0x30, "BMI", 2, true,  op_bmi, ADDR_MODE_RELATIVE),
-    INS(0x31, "AND", 5, true,  op_and, ADDR_MODE_INDIRECT_Y),
-    INE(0x32),
-    INE(0x33),
-    INE(0x34),
-    INS(0x35, "AND", 4, false, op_and, ADDR_MODE_ZERO_PAGE_X),
-    INS(0x36, "ROL", 6, false, op_rol, ADDR_MODE_ZERO_PAGE_X),
-    INE(0x37),
-    INS(0x38, "SEC", 2, false, op_sec, ADDR_MODE_IMPLIED),
-    INS(0x39, "AND", 4, true,  op_and, ADDR_MODE_ABSOLUTE_Y),
-    INE(0x3a),
-    INE(0x3b),
-    INE(0x3c),
-    INS(0x3d, "AND", 4, true,  op_and, ADDR_MODE_ABSOLUTE_X),
-    INS(0x3e, "ROL", 7, false, op_rol, ADDR_MODE_ABSOLUTE_X),
-    INE(0x3f),
-    INS(0x40, "RTI", 6, false, op_rti, ADDR_MODE_IMPLIED),
-    INS(0x41, "EOR", 6, false, op_eor, ADDR_MODE_INDIRECT_X),
-    INE(0x42),
-    INE(0x43),
-    INE(0x44),
-    INS(0x45, "EOR", 3, false, op_eor, ADDR_MODE_ZERO_PAGE),
-    INS(0x46, "LSR", 5, false, op_lsr, ADDR_MODE_ZERO_PAGE),
-    INE(0x47),
-    INS(0x48, "PHA", 3, false, op_pha, ADDR_MODE_IMPLIED),
-    INS(0x49, "EOR", 2, false, op_eor, ADDR_MODE_IMMEDIATE),
-    INS(0x4a, "LSR", 2, false, op_lsr, ADDR_MODE_ACCUMULATOR),
-    INE(0x4b),
-    INS(0x4c, "JMP", 3, false, op_jmp, ADDR_MODE_ABSOLUTE),
-    INS(0x4d, "EOR", 4, false, op_eor, ADDR_MODE_ABSOLUTE),
-    INS(0x4e, "LSR", 6, false, op_lsr, ADDR_MODE_ABSOLUTE),
-    INE(0x4f),
-    INS(0x50, "BVC", 2, true,  op_bvc, ADDR_MODE_RELATIVE),
-    INS(0x51, "EOR", 5, true,  op_eor, ADDR_MODE_INDIRECT_Y),
-    INE(0x52),
-    INE(0x53),
-    INE(0x54),
-    INS(0x55, "EOR", 4, false, op_eor, ADDR_MODE_ZERO_PAGE_X),
-    INS(0x56, "LSR", 6, false, op_lsr, ADDR_MODE_ZERO_PAGE_X),
-    INE(0x57),
-    INS(0x58, "CLI", 2, false, op_cli, ADDR_MODE_IMPLIED),
-    INS(0x59, "EOR", 4, true,  op_eor, ADDR_MODE_ABSOLUTE_Y),
-    INE(0x5a),
-    INE(0x5b),
-    INE(0x5c),
-    INS(0x5d, "EOR", 4, true,  op_eor, ADDR_MODE_ABSOLUTE_X),
-    INS(0x5e, "LSR", 7, false, op_lsr, ADDR_MODE_ABSOLUTE_X),
-    INE(0x5f),
-    INS(0x60, "RTS", 6, false, op_rts, ADDR_MODE_IMPLIED),
-    INS(0x61, "ADC", 6, false, op_adc, ADDR_MODE_INDIRECT_X),
-    INE(0x62),
-    INE(0x63),
-    INE(0x64),
-    INS(0x65, "ADC", 3, false, op_adc, ADDR_MODE_ZERO_PAGE),
-    INS(0x66, "ROR", 5, false, op_ror, ADDR_MODE_ZERO_PAGE),
-    INE(0x67),
-    INS(0x68, "PLA", 4, false, op_pla, ADDR_MODE_IMPLIED),
-    INS(0x69, "ADC", 2, false, op_adc, ADDR_MODE_IMMEDIATE),
-    INS(0x6a, "ROR", 2, false, op_ror, ADDR_MODE_ACCUMULATOR),
-    INE(0x6b),
-    INS(0x6c, "JMP", 5, false, op_jmp, ADDR_MODE_INDIRECT),
-    INS(0x6d, "ADC", 4, false,  op_adc, ADDR_MODE_ABSOLUTE),
-    INS(0x6e, "ROR", 6, false, op_ror, ADDR_MODE_ABSOLUTE),
-    INE(0x6f),
-    INS(0x70, "BVS", 2, true,  op_bvs, ADDR_MODE_RELATIVE),
-    INS(0x71, "ADC", 5, true,  op_adc, ADDR_MODE_INDIRECT_Y),
-    INE(0x72),
-    INE(0x73),
-    INE(0x74),
-    INS(0x75, "ADC", 4, false, op_adc, ADDR_MODE_ZERO_PAGE_X),
-    INS(0x76, "ROR", 6, false, op_ror, ADDR_MODE_ZERO_PAGE_X),
-    INE(0x77),
-    INS(0x78, "SEI", 2, false, op_sei, ADDR_MODE_IMPLIED),
-    INS(0x79, "ADC", 4, true,  op_adc, ADDR_MODE_ABSOLUTE_Y),
-    INE(0x7a),
-    INE(0x7b),
-    INE(0x7c),
-    INS(0x7d, "ADC", 4, true,  op_adc, ADDR_MODE_ABSOLUTE_X),
-    INS(0x7e, "ROR", 7, false, op_ror, ADDR_MODE_ABSOLUTE_X),
-    INE(0x7f),
-    INE(0x80),
-    INS(0x81, "STA", 6, false, op_sta, ADDR_MODE_INDIRECT_X),
-    INE(0x82),
-    INE(0x83),
-    INS(0x84, "STY", 3, false, op_sty, ADDR_MODE_ZERO_PAGE),
-    INS(0x85, "STA", 3, false, op_sta, ADDR_MODE_ZERO_PAGE),
-    INS(0x86, "STX", 3, false, op_stx, ADDR_MODE_ZERO_PAGE),
-    INE(0x87),
-    INS(0x88, "DEY", 2, false, op_dey, ADDR_MODE_IMPLIED),
-    INE(0x89),
-    INS(0x8a, "TXA", 2, false, op_txa, ADDR_MODE_IMPLIED),
-    INE(0x8b),
-    INS(0x8c, "STY", 4, false, op_sty, ADDR_MODE_ABSOLUTE),
-    INS(0x8d, "STA", 4, false, op_sta, ADDR_MODE_ABSOLUTE),
-    INS(0x8e, "STX", 4, false, op_stx, ADDR_MODE_ABSOLUTE),
-    INE(0x8f),
-    INS(0x90, "BCC", 2, true,  op_bcc, ADDR_MODE_RELATIVE),
-    INS(0x91, "STA", 6, false, op_sta, ADDR_MODE_INDIRECT_Y),
-    INE(0x92),
-    INE(0x93),
-    INS(0x94, "STY", 4, false, op_sty, ADDR_MODE_ZERO_PAGE_X),
-    INS(0x95, "STA", 4, false, op_sta, ADDR_MODE_ZERO_PAGE_X),
-    INS(0x96, "STX", 4, false, op_stx, ADDR_MODE_ZERO_PAGE_Y),
-    INE(0x97),
-    INS(0x98, "TYA", 2, false, op_tya, ADDR_MODE_IMPLIED),
-    INS(0x99, "STA", 5, false, op_sta, ADDR_MODE_ABSOLUTE_Y),
-    INS(0x9a, "TXS", 2, false, op_txs, ADDR_MODE_IMPLIED),
-    INE(0x9b),
-    INE(0x9c),
-    INS(0x9d, "STA", 5, false, op_sta, ADDR_MODE_ABSOLUTE_X),
-    INE(0x9e),
-    INE(0x9f),
-    INS(0xa0, "LDY", 2, false, op_ldy, ADDR_MODE_IMMEDIATE),
-    INS(0xa1, "LDA", 6, false, op_lda, ADDR_MODE_INDIRECT_X),
-    INS(0xa2, "LDX", 2, false, op_ldx, ADDR_MODE_IMMEDIATE),
-    INE(0xa3),
-    INS(0xa4, "LDY", 3, false, op_ldy, ADDR_MODE_ZERO_PAGE),
-    INS(0xa5, "LDA", 3, false, op_lda, ADDR_MODE_ZERO_PAGE),
-    INS(0xa6, "LDX", 3, false, op_ldx, ADDR_MODE_ZERO_PAGE),
-    INE(0xa7),
-    INS(0xa8, "TAY", 2, false, op_tay, ADDR_MODE_IMPLIED),
-    INS(0xa9, "LDA", 2, false, op_lda, ADDR_MODE_IMMEDIATE),
-    INS(0xaa, "TAX", 2, false, op_tax, ADDR_MODE_IMPLIED),
-    INE(0xab),
-    INS(0xac, "LDY", 4, false, op_ldy, ADDR_MODE_ABSOLUTE),
-    INS(0xad, "LDA", 4, false, op_lda, ADDR_MODE_ABSOLUTE),
-    INS(0xae, "LDX", 4, false, op_ldx, ADDR_MODE_ABSOLUTE),
-    INE(0xaf),
-    INS(0xb0, "BCS", 2, true,  op_bcs, ADDR_MODE_RELATIVE),
-    INS(0xb1, "LDA", 5, true,  op_lda, ADDR_MODE_INDIRECT_Y),
-    INE(0xb2),
-    INE(0xb3),
-    INS(0xb4, "LDY", 4, false, op_ldy, ADDR_MODE_ZERO_PAGE_X),
-    INS(0xb5, "LDA", 4, false, op_lda, ADDR_MODE_ZERO_PAGE_X),
-    INS(0xb6, "LDX", 4, false, op_ldx, ADDR_MODE_ZERO_PAGE_Y),
-    INE(0xb7),
-    INS(0xb8, "CLV", 2, false, op_clv, ADDR_MODE_IMPLIED),
-    INS(0xb9, "LDA", 4, true,  op_lda, ADDR_MODE_ABSOLUTE_Y),
-    INS(0xba, "TSX", 2, false, op_tsx, ADDR_MODE_IMPLIED),
-    INE(0xbb),
-    INS(0xbc, "LDY", 4, true,  op_ldy, ADDR_MODE_ABSOLUTE_X),
-    INS(0xbd, "LDA", 4, true,  op_lda, ADDR_MODE_ABSOLUTE_X),
-    INS(0xbe, "LDX", 4, true,  op_ldx, ADDR_MODE_ABSOLUTE_Y),
-    INE(0xbf),
-    INS(0xc0, "CPY", 2, false, op_cpy, ADDR_MODE_IMMEDIATE),
-    INS(0xc1, "CMP", 6, false, op_cmp, ADDR_MODE_INDIRECT_X),
-    INE(0xc2),
-    INE(0xc3),
-    INS(0xc4, "CPY", 3, false, op_cpy, ADDR_MODE_ZERO_PAGE),
-    INS(0xc5, "CMP", 3, false, op_cmp, ADDR_MODE_ZERO_PAGE),
-    INS(0xc6, "DEC", 5, false, op_dec, ADDR_MODE_ZERO_PAGE),
-    INE(0xc7),
-    INS(0xc8, "INY", 2, false, op_iny, ADDR_MODE_IMPLIED),
-    INS(0xc9, "CMP", 2, false, op_cmp, ADDR_MODE_IMMEDIATE),
-    INS(0xca, "DEX", 2, false, op_dex, ADDR_MODE_IMPLIED),
-    INE(0xcb),
-    INS(0xcc, "CPY", 4, false, op_cpy, ADDR_MODE_ABSOLUTE),
-    INS(0xcd, "CMP", 4, false, op_cmp, ADDR_MODE_ABSOLUTE),
-    INS(0xce, "DEC", 6, false, op_dec, ADDR_MODE_ABSOLUTE),
-    INE(0xcf),
-    INS(0xd0, "BNE", 2, true,  op_bne, ADDR_MODE_RELATIVE),
-    INS(0xd1, "CMP", 5, true,  op_cmp, ADDR_MODE_INDIRECT_Y),
-    INE(0xd2),
-    INE(0xd3),
-    INE(0xd4),
-    INS(0xd5, "CMP", 4, false, op_cmp, ADDR_MODE_ZERO_PAGE_X),
-    INS(0xd6, "DEC", 6, false, op_dec, ADDR_MODE_ZERO_PAGE_X),
-    INE(0xd7),
-    INS(0xd8, "CLD", 2, false, op_cld, ADDR_MODE_IMPLIED),
-    INS(0xd9, "CMP", 4, true,  op_cmp, ADDR_MODE_ABSOLUTE_Y),
-    INE(0xda),
-    INE(0xdb),
-    INE(0xdc),
-    INS(0xdd, "CMP", 4, true,  op_cmp, ADDR_MODE_ABSOLUTE_X),
-    INS(0xde, "DEC", 7, false, op_dec, ADDR_MODE_ABSOLUTE_X),
-    INE(0xdf),
-    INS(0xe0, "CPX", 2, false, op_cpx, ADDR_MODE_IMMEDIATE),
-    INS(0xe1, "SBC", 6, false, op_sbc, ADDR_MODE_INDIRECT_X),
-    INE(0xe2),
-    INE(0xe3),
-    INS(0xe4, "CPX", 3, false, op_cpx, ADDR_MODE_ZERO_PAGE),
-    INS(0xe5, "SBC", 3, false, op_sbc, ADDR_MODE_ZERO_PAGE),
-    INS(0xe6, "INC", 5, false, op_inc, ADDR_MODE_ZERO_PAGE),
-    INE(0xe7),
-    INS(0xe8, "INX", 2, false, op_inx, ADDR_MODE_IMPLIED),
-    INS(0xe9, "SBC", 2, false, op_sbc, ADDR_MODE_IMMEDIATE),
-    INS(0xea, "NOP", 2, false, op_nop, ADDR_MODE_IMPLIED),
-    INE(0xeb),
-    INS(0xec, "CPX", 4, false, op_cpx, ADDR_MODE_ABSOLUTE),
-    INS(0xed, "SBC", 4, false, op_sbc, ADDR_MODE_ABSOLUTE),
-    INS(0xee, "INC", 6, false, op_inc, ADDR_MODE_ABSOLUTE),
-    INE(0xef),
-    INS(0xf0, "BEQ", 2, true,  op_beq, ADDR_MODE_RELATIVE),
-    INS(0xf1, "SBC", 5, true,  op_sbc, ADDR_MODE_INDIRECT_Y),
-    INE(0xf2),
-    INE(0xf3),
-    INE(0xf4),
-    INS(0xf5, "SBC", 4, false, op_sbc, ADDR_MODE_ZERO_PAGE_X),
-    INS(0xf6, "INC", 6, false, op_inc, ADDR_MODE_ZERO_PAGE_X),
-    INE(0xf7),
-    INS(0xf8, "SED", 2, false, op_sed, ADDR_MODE_IMPLIED),
-    INS(0xf9, "SBC", 4, true,  op_sbc, ADDR_MODE_ABSOLUTE_Y),
-    INE(0xfa),
-    INE(0xfb),
-    INE(0xfc),
-    INS(0xfd, "SBC", 4, true,  op_sbc, ADDR_MODE_ABSOLUTE_X),
-    INS(0xfe, "INC", 7, false, op_inc, ADDR_MODE_ABSOLUTE_X),
-    INE(0xff),
+    INSTRUCTIONS(INS_TABLE_ENTRY, INE_TABLE_ENTRY)
 };
 
-#undef INE
-#undef INS
+#undef INE_TABLE_ENTRY
+#undef INS_TABLE_ENTRY
+
+// Sequences common in games that block execution runs with a single handler (see blocks.c),
+// which saves dispatching all but the first instruction. Every instruction has to be allowed
+// in blocks and only the last one can end a block.
+#define FUSIONS(FUS2, FUS3) \
+    FUS2(LDA_IMM_STA_ZP,     "LDA imm, STA zp",          0xa9, 0x85)       \
+    FUS2(LDA_IMM_STA_ABS,    "LDA imm, STA abs",         0xa9, 0x8d)       \
+    FUS2(LDA_ZP_STA_ZP,      "LDA zp, STA zp",           0xa5, 0x85)       \
+    FUS2(LDA_ZP_STA_ABS,     "LDA zp, STA abs",          0xa5, 0x8d)       \
+    FUS2(LDA_ABS_STA_ZP,     "LDA abs, STA zp",          0xad, 0x85)       \
+    FUS2(LDA_ABS_STA_ABS,    "LDA abs, STA abs",         0xad, 0x8d)       \
+    FUS2(LDA_ABSX_STA_ABSX,  "LDA abs,X, STA abs,X",     0xbd, 0x9d)       \
+    FUS2(LDA_ABSX_STA_ABSY,  "LDA abs,X, STA abs,Y",     0xbd, 0x99)       \
+    FUS2(LDA_ABSY_STA_ABSX,  "LDA abs,Y, STA abs,X",     0xb9, 0x9d)       \
+    FUS2(LDA_ABSY_STA_ABSY,  "LDA abs,Y, STA abs,Y",     0xb9, 0x99)       \
+    FUS2(LDA_ZP_BEQ,         "LDA zp, BEQ",              0xa5, 0xf0)       \
+    FUS2(LDA_ZP_BNE,         "LDA zp, BNE",              0xa5, 0xd0)       \
+    FUS2(CMP_IMM_BEQ,        "CMP imm, BEQ",             0xc9, 0xf0)       \
+    FUS2(CMP_IMM_BNE,        "CMP imm, BNE",             0xc9, 0xd0)       \
+    FUS2(DEX_BNE,            "DEX, BNE",                 0xca, 0xd0)       \
+    FUS2(DEY_BNE,            "DEY, BNE",                 0x88, 0xd0)       \
+    FUS2(INX_BNE,            "INX, BNE",                 0xe8, 0xd0)       \
+    FUS2(INY_BNE,            "INY, BNE",                 0xc8, 0xd0)       \
+    FUS3(INX_CPX_IMM_BNE,    "INX, CPX imm, BNE",        0xe8, 0xe0, 0xd0) \
+    FUS3(INY_CPY_IMM_BNE,    "INY, CPY imm, BNE",        0xc8, 0xc0, 0xd0)
+
+#define FUS2_ENUM(ID, NAME, OPC1, OPC2) FUSION_##ID,
+#define FUS3_ENUM(ID, NAME, OPC1, OPC2, OPC3) FUSION_##ID,
+
+enum {
+    FUSION_NONE = 0,
+    FUSIONS(FUS2_ENUM, FUS3_ENUM)
+    FUSIONS_COUNT
+};
+
+#undef FUS3_ENUM
+#undef FUS2_ENUM
+
+typedef char fusions_count_check[FUSIONS_COUNT <= FUSIONS_MAX ? 1 : -1];
+
+typedef struct {
+    const char *name;
+    int length;
+    uint8_t opcodes[3];
+} fusion_t;
+
+#define FUS2_TABLE_ENTRY(ID, NAME, OPC1, OPC2) { NAME, 2, { OPC1, OPC2, 0 } },
+#define FUS3_TABLE_ENTRY(ID, NAME, OPC1, OPC2, OPC3) { NAME, 3, { OPC1, OPC2, OPC3 } },
+
+static const fusion_t fusions[FUSIONS_COUNT] = {
+    { "NONE", 0, { 0, 0, 0 } },
+    FUSIONS(FUS2_TABLE_ENTRY, FUS3_TABLE_ENTRY)
+};
+
+#undef FUS3_TABLE_ENTRY
+#undef FUS2_TABLE_ENTRY
 
 instruction_t* instruction_get(uint8_t opc) {
     return &instructions[opc];
@@ -354,6 +421,131 @@ uint8_t instruction_get_size(addr_mode_t mode) {
     }
 }
 
+// Read-modify-write instructions count as writes
+bool instruction_writes_memory(uint8_t opcode) {
+    const instruction_t *ins = &instructions[opcode];
+    if (ins->mode == ADDR_MODE_ACCUMULATOR) {
+        return false;
+    }
+    instruction_op_fn op = ins->operation;
+    return op == op_sta || op == op_stx || op == op_sty
+        || op == op_inc || op == op_dec
+        || op == op_asl || op == op_lsr || op == op_rol || op == op_ror;
+}
+
+// Longest fusion that the opcodes start with, FUSION_NONE if there isn't any
+uint8_t instruction_find_fusion(const uint8_t *opcodes, int count) {
+    uint8_t res = FUSION_NONE;
+    for (int i = 1; i < FUSIONS_COUNT; i++) {
+        const fusion_t *fusion = &fusions[i];
+        if (fusion->length > count || fusion->length <= fusions[res].length) {
+            continue;
+        }
+        bool match = true;
+        for (int j = 0; j < fusion->length; j++) {
+            match = match && fusion->opcodes[j] == opcodes[j];
+        }
+        if (match) {
+            res = i;
+        }
+    }
+    return res;
+}
+
+int instruction_get_fusion_length(uint8_t fusion) {
+    return fusions[fusion].length;
+}
+
+const char* instruction_get_fusion_name(uint8_t fusion) {
+    return fusions[fusion].name;
+}
+
+int instruction_get_fusions_count(void) {
+    return FUSIONS_COUNT;
+}
+
+// Raw operand bytes of the instruction at addr (0 for modes that don't have any)
+uint16_t instruction_fetch_operand(cpu_t *cpu, uint16_t addr, uint8_t opcode) {
+    return fetch_operand(cpu, addr, instructions[opcode].mode);
+}
+
+// Each opcode gets its own case with the addressing mode, cycle count and page cross rule
+// known at compile time, so execute() and the op_* function get inlined and specialized.
+// Defining AGNES_COMPUTED_GOTO replaces the switch with a table of label addresses (GNU C).
+int instruction_execute(cpu_t *cpu, uint8_t opcode, uint16_t operand) {
+#ifdef AGNES_COMPUTED_GOTO
+#define INS_LABEL(OPC, NAME, CYCLES, PCC, OP, MODE) &&ins_##OPC,
+#define INE_LABEL(OPC) &&ins_illegal,
+#define INS_TARGET(OPC, NAME, CYCLES, PCC, OP, MODE) \
+    ins_##OPC: return execute(cpu, operand, OP, MODE, CYCLES, PCC);
+#define INE_TARGET(OPC)
+
+    static const void *labels[256] = {
+        INSTRUCTIONS(INS_LABEL, INE_LABEL)
+    };
+    goto *labels[opcode];
+    INSTRUCTIONS(INS_TARGET, INE_TARGET)
+ins_illegal:
+    return 0;
+
+#undef INE_TARGET
+#undef INS_TARGET
+#undef INE_LABEL
+#undef INS_LABEL
+#else
+#define INS_CASE(OPC, NAME, CYCLES, PCC, OP, MODE) \
+    case OPC: return execute(cpu, operand, OP, MODE, CYCLES, PCC);
+#define INE_CASE(OPC) case OPC: return 0;
+
+    switch (opcode) {
+        INSTRUCTIONS(INS_CASE, INE_CASE)
+    }
+    return 0;
+
+#undef INE_CASE
+#undef INS_CASE
+#endif
+}
+
+#define INS_HANDLER(OPC, NAME, CYCLES, PCC, OP, MODE) \
+    static AGNES_FORCE_INLINE int execute_##OPC(cpu_t *cpu, uint16_t operand) { \
+        return execute(cpu, operand, OP, MODE, CYCLES, PCC); \
+    }
+#define INE_HANDLER(OPC)
+
+INSTRUCTIONS(INS_HANDLER, INE_HANDLER)
+
+#undef INE_HANDLER
+#undef INS_HANDLER
+
+// Instructions of a fusion have consecutive entries in the decode cache (they're in the same page)
+int instruction_execute_fused(cpu_t *cpu, uint8_t fusion, const decoded_instruction_t *decoded) {
+#define FUS2_CASE(ID, NAME, OPC1, OPC2) \
+    case FUSION_##ID: { \
+        const decoded_instruction_t *second = decoded + decoded->size; \
+        int cycles = execute_##OPC1(cpu, decoded->operand); \
+        cycles += execute_##OPC2(cpu, second->operand); \
+        return cycles; \
+    }
+#define FUS3_CASE(ID, NAME, OPC1, OPC2, OPC3) \
+    case FUSION_##ID: { \
+        const decoded_instruction_t *second = decoded + decoded->size; \
+        const decoded_instruction_t *third = second + second->size; \
+        int cycles = execute_##OPC1(cpu, decoded->operand); \
+        cycles += execute_##OPC2(cpu, second->operand); \
+        cycles += execute_##OPC3(cpu, third->operand); \
+        return cycles; \
+    }
+
+    switch (fusion) {
+        FUSIONS(FUS2_CASE, FUS3_CASE)
+        default: return 0;
+    }
+
+#undef FUS3_CASE
+#undef FUS2_CASE
+}
+
 static int op_adc(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     uint8_t old_acc = cpu->acc;
     uint8_t val = cpu_read8(cpu, addr);
@@ -396,28 +588,27 @@ static int op_bcs(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
 }
 
 static int op_beq(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    return cpu->flag_zero ? take_branch(cpu, addr) : 0;
+    return CPU_FLAG_ZERO(cpu) ? take_branch(cpu, addr) : 0;
 }
 
 static int op_bit(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     uint8_t val = cpu_read8(cpu, addr);
     uint8_t res = cpu->acc & val;
-    cpu->flag_zero = res == 0;
     cpu->flag_overflow = AGNES_GET_BIT(val, 6);
-    cpu->flag_negative = AGNES_GET_BIT(val, 7);
+    cpu->zn_result = (res != 0) | (AGNES_GET_BIT(val, 7) << 8);
     return 0;
 }
 
 static int op_bmi(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    return cpu->flag_negative ? take_branch(cpu, addr) : 0;
+    return CPU_FLAG_NEGATIVE(cpu) ? take_branch(cpu, addr) : 0;
 }
 
 static int op_bne(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    return !cpu->flag_zero ? take_branch(cpu, addr) : 0;
+    return !CPU_FLAG_ZERO(cpu) ? take_branch(cpu, addr) : 0;
 }
 
 static int op_bpl(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    return !cpu->flag_negative ? take_branch(cpu, addr) : 0;
+    return !CPU_FLAG_NEGATIVE(cpu) ? take_branch(cpu, addr) : 0;
 }
 
 static int op_brk(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
@@ -729,3 +920,101 @@ static int take_branch(cpu_t *cpu, uint16_t addr) {
     cpu->pc = addr;
     return page_crossed ? 2 : 1;
 }
+
+static AGNES_FORCE_INLINE int execute(cpu_t *cpu, uint16_t operand, instruction_op_fn op, addr_mode_t mode, int cycles, bool page_cross_cycle) {
+    bool page_crossed = false;
+    uint16_t addr = resolve_address(cpu, mode, operand, &page_crossed);
+
+    cpu->pc += instruction_get_size(mode);
+
+    cycles += op(cpu, addr, mode);
+
+    if (page_crossed && page_cross_cycle) {
+        cycles += 1;
+    }
+    return cycles;
+}
+
+static uint16_t fetch_operand(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    switch (mode) {
+        case ADDR_MODE_ABSOLUTE:
+        case ADDR_MODE_ABSOLUTE_X:
+        case ADDR_MODE_ABSOLUTE_Y:
+        case ADDR_MODE_INDIRECT: {
+            return cpu_read16(cpu, addr + 1);
+        }
+        case ADDR_MODE_INDIRECT_X:
+        case ADDR_MODE_INDIRECT_Y:
+        case ADDR_MODE_RELATIVE:
+        case ADDR_MODE_ZERO_PAGE:
+        case ADDR_MODE_ZERO_PAGE_X:
+        case ADDR_MODE_ZERO_PAGE_Y: {
+            return cpu_read8(cpu, addr + 1);
+        }
+        default: {
+            return 0;
+        }
+    }
+}
+
+static AGNES_FORCE_INLINE uint16_t resolve_address(cpu_t *cpu, addr_mode_t mode, uint16_t operand, bool *out_pages_differ) {
+    switch (mode) {
+        case ADDR_MODE_ABSOLUTE: {
+            return operand;
+        }
+        case ADDR_MODE_ABSOLUTE_X: {
+            uint16_t res = operand + cpu->x;
+            *out_pages_differ = check_pages_differ(operand, res);
+            return res;
+        }
+        case ADDR_MODE_ABSOLUTE_Y: {
+            uint16_t res = operand + cpu->y;
+            *out_pages_differ = check_pages_differ(operand, res);
+            return res;
+        }
+        case ADDR_MODE_IMMEDIATE: {
+            return cpu->pc + 1;
+        }
+        case ADDR_MODE_INDIRECT: {
+            return read16_indirect_bug(cpu, operand);
+        }
+        case ADDR_MODE_INDIRECT_X: {
+            return read16_indirect_bug(cpu, (operand + cpu->x) & 0xff);
+        }
+        case ADDR_MODE_INDIRECT_Y: {
+            uint16_t addr = read16_indirect_bug(cpu, operand);
+            uint16_t res = addr + cpu->y;
+            *out_pages_differ = check_pages_differ(addr, res);
+            return res;
+        }
+        case ADDR_MODE_ZERO_PAGE: {
+            return operand;
+        }
+        case ADDR_MODE_ZERO_PAGE_X: {
+            return (operand + cpu->x) & 0xff;
+        }
+        case ADDR_MODE_ZERO_PAGE_Y: {
+            return (operand + cpu->y) & 0xff;
+        }
+        case ADDR_MODE_RELATIVE: {
+            if (operand < 0x80) {
+                return cpu->pc + operand + 2;
+            } else {
+                return cpu->pc + operand + 2 - 0x100;
+            }
+        }
+        default: {
+            return 0;
+        }
+    }
+}
+
+static uint16_t read16_indirect_bug(cpu_t *cpu, uint16_t addr) {
+    uint8_t lo = cpu_read8(cpu, addr);
+    uint8_t hi = cpu_read8(cpu, (addr & 0xff00) | ((addr + 1) & 0x00ff));
+    return (hi << 8) | lo;
+}
+
+static bool check_pages_differ(uint16_t a, uint16_t b) {
+    return (0xff00 & a) != (0xff00 & b);
+}
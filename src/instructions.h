@@ -24,6 +24,7 @@ typedef enum {
 } addr_mode_t;
 
 typedef struct cpu cpu_t;
+typedef struct decoded_instruction decoded_instruction_t;
 
 typedef int (*instruction_op_fn)(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
 
@@ -38,5 +39,13 @@ typedef struct {
 
 AGNES_INTERNAL instruction_t* instruction_get(uint8_t opcode);
 AGNES_INTERNAL uint8_t instruction_get_size(addr_mode_t mode);
+AGNES_INTERNAL bool instruction_writes_memory(uint8_t opcode);
+AGNES_INTERNAL uint16_t instruction_fetch_operand(cpu_t *cpu, uint16_t addr, uint8_t opcode);
+AGNES_INTERNAL int instruction_execute(cpu_t *cpu, uint8_t opcode, uint16_t operand);
+AGNES_INTERNAL uint8_t instruction_find_fusion(const uint8_t *opcodes, int count);
+AGNES_INTERNAL int instruction_get_fusion_length(uint8_t fusion);
+AGNES_INTERNAL const char* instruction_get_fusion_name(uint8_t fusion);
+AGNES_INTERNAL int instruction_get_fusions_count(void);
+AGNES_INTERNAL int instruction_execute_fused(cpu_t *cpu, uint8_t fusion, const decoded_instruction_t *decoded);
 
 #endif /* opcodes_h */
@@ -1,7 +1,9 @@
 #ifndef AGNES_AMALGAMATED
-#include "mapper0.h"
+#include "mapper.h"
 
 #include "agnes_types.h"
+#include "cpu.h"
+#include "ppu.h"
 
 #include "mapper0.h"
 #include "mapper1.h"
@@ -9,6 +11,8 @@
 #include "mapper4.h"
 #endif
 
+static const uint8_t* get_chr_memory(agnes_t *agnes);
+
 bool mapper_init(agnes_t *agnes) {
     switch (agnes->gamepack.mapper) {
         case 0: mapper0_init(&agnes->mapper.m0, agnes); return true;
@@ -30,6 +34,7 @@ uint8_t mapper_read(agnes_t *agnes, uint16_t addr) {
 }
 
 void mapper_write(agnes_t *agnes, uint16_t addr, uint8_t val) {
+    ppu_sync_line(&agnes->ppu); // CHR banks and mirroring can change
     switch (agnes->gamepack.mapper) {
         case 0: mapper0_write(&agnes->mapper.m0, addr, val); break;
         case 1: mapper1_write(&agnes->mapper.m1, addr, val); break;
@@ -38,8 +43,92 @@ void mapper_write(agnes_t *agnes, uint16_t addr, uint8_t val) {
     }
 }
 
+void mapper_map_memory(agnes_t *agnes) {
+    switch (agnes->gamepack.mapper) {
+        case 0: mapper0_map_memory(&agnes->mapper.m0); break;
+        case 1: mapper1_map_memory(&agnes->mapper.m1); break;
+        case 2: mapper2_map_memory(&agnes->mapper.m2); break;
+        case 4: mapper4_map_memory(&agnes->mapper.m4); break;
+    }
+    mapper_map_nametables(agnes);
+}
+
+// Has to be called after changing agnes->mirroring_mode
+void mapper_map_nametables(agnes_t *agnes) {
+    unsigned tables[4] = { 0, 0, 0, 0 };
+    switch (agnes->mirroring_mode) {
+        case MIRRORING_MODE_HORIZONTAL:   tables[2] = tables[3] = 1; break;
+        case MIRRORING_MODE_VERTICAL:     tables[1] = tables[3] = 1; break;
+        case MIRRORING_MODE_SINGLE_UPPER: tables[0] = tables[1] = tables[2] = tables[3] = 1; break;
+        case MIRRORING_MODE_FOUR_SCREEN:  tables[1] = 1; tables[2] = 2; tables[3] = 3; break;
+        default: break;
+    }
+    for (int i = 0; i < 4; i++) {
+        agnes->ppu.nametable_pages[i] = agnes->ppu.nametables + (tables[i] * 1024);
+    }
+}
+
+void mapper_map_prg_rom(agnes_t *agnes, uint16_t addr, unsigned size, unsigned prg_rom_offset) {
+    const uint8_t *prg_rom = agnes->gamepack.data + agnes->gamepack.prg_rom_offset;
+    cpu_map_memory(&agnes->cpu, addr, size, prg_rom + prg_rom_offset, NULL);
+
+    unsigned prg_rom_size = agnes->gamepack.prg_rom_banks_count * (16 * 1024);
+    if (agnes->decode_cache && (prg_rom_offset + size) <= prg_rom_size) {
+        cpu_map_decode_cache(&agnes->cpu, addr, size, agnes->decode_cache + prg_rom_offset);
+    }
+}
+
+// CHR-RAM is used when the gamepack has no CHR-ROM
+unsigned mapper_get_chr_size(const agnes_t *agnes) {
+    unsigned chr_rom_size = agnes->gamepack.chr_rom_banks_count * (8 * 1024);
+    return chr_rom_size > 0 ? chr_rom_size : (8 * 1024);
+}
+
+// chr_offset is a physical offset into CHR-ROM or CHR-RAM, wraps around like bank numbers do
+void mapper_map_chr(agnes_t *agnes, uint16_t addr, unsigned size, unsigned chr_offset) {
+    unsigned chr_size = mapper_get_chr_size(agnes);
+    unsigned first_page = addr >> 10;
+    unsigned pages_count = size >> 10;
+    for (unsigned i = 0; i < pages_count; i++) {
+        unsigned offset = (chr_offset + (i << 10)) % chr_size;
+        agnes->ppu.chr_pages[first_page + i] = agnes->chr_cache + (offset >> 1); // 8 rows per 16 bytes
+    }
+}
+
+void mapper_decode_chr(agnes_t *agnes) {
+    unsigned chr_size = mapper_get_chr_size(agnes);
+    for (unsigned offset = 0; offset < chr_size; offset += 16) {
+        for (unsigned y = 0; y < 8; y++) {
+            mapper_decode_chr_row(agnes, offset + y);
+        }
+    }
+}
+
+// Has to be called after writing to CHR-RAM, offset of either plane's byte
+void mapper_decode_chr_row(agnes_t *agnes, unsigned chr_offset) {
+    const uint8_t *chr = get_chr_memory(agnes);
+    unsigned lo_offset = chr_offset & ~0x8u;
+    uint8_t lo = chr[lo_offset];
+    uint8_t hi = chr[lo_offset + 8];
+    chr_row_t *row = &agnes->chr_cache[((lo_offset & ~0xfu) >> 1) | (lo_offset & 0x7)];
+    ppu_decode_chr_row(row, lo, hi);
+}
+
 void mapper_pa12_rising_edge(agnes_t *agnes) {
     switch (agnes->gamepack.mapper) {
         case 4: mapper4_pa12_rising_edge(&agnes->mapper.m4); break;
     }
 }
+
+static const uint8_t* get_chr_memory(agnes_t *agnes) {
+    if (agnes->gamepack.chr_rom_banks_count > 0) {
+        return agnes->gamepack.data + agnes->gamepack.chr_rom_offset;
+    }
+    switch (agnes->gamepack.mapper) {
+        case 0: return agnes->mapper.m0.chr_ram;
+        case 1: return agnes->mapper.m1.chr_ram;
+        case 2: return agnes->mapper.m2.chr_ram;
+        case 4: return agnes->mapper.m4.chr_ram;
+        default: return NULL;
+    }
+}
@@ -10,6 +10,13 @@ typedef struct agnes agnes_t;
 AGNES_INTERNAL bool mapper_init(agnes_t *agnes);
 AGNES_INTERNAL uint8_t mapper_read(agnes_t *agnes, uint16_t addr);
 AGNES_INTERNAL void mapper_write(agnes_t *agnes, uint16_t addr, uint8_t val);
+AGNES_INTERNAL void mapper_map_memory(agnes_t *agnes);
+AGNES_INTERNAL void mapper_map_nametables(agnes_t *agnes);
+AGNES_INTERNAL void mapper_map_prg_rom(agnes_t *agnes, uint16_t addr, unsigned size, unsigned prg_rom_offset);
+AGNES_INTERNAL unsigned mapper_get_chr_size(const agnes_t *agnes);
+AGNES_INTERNAL void mapper_map_chr(agnes_t *agnes, uint16_t addr, unsigned size, unsigned chr_offset);
+AGNES_INTERNAL void mapper_decode_chr(agnes_t *agnes);
+AGNES_INTERNAL void mapper_decode_chr_row(agnes_t *agnes, unsigned chr_offset);
 AGNES_INTERNAL void mapper_pa12_rising_edge(agnes_t *agnes);
 
 #endif /* mapper_h */
@@ -2,6 +2,8 @@
 #include "mapper0.h"
 
 #include "agnes_types.h"
+#include "cpu.h"
+#include "mapper.h"
 #endif
 
 void mapper0_init(mapper0_t *mapper, agnes_t *agnes) {
@@ -33,5 +35,13 @@ uint8_t mapper0_read(mapper0_t *mapper, uint16_t addr) {
 void mapper0_write(mapper0_t *mapper, uint16_t addr, uint8_t val) {
     if (mapper->use_chr_ram && addr < 0x2000) {
         mapper->chr_ram[addr] = val;
+        mapper_decode_chr_row(mapper->agnes, addr);
     }
 }
+
+void mapper0_map_memory(mapper0_t *mapper) {
+    agnes_t *agnes = mapper->agnes;
+    mapper_map_prg_rom(agnes, 0x8000, 16 * 1024, mapper->prg_bank_offsets[0]);
+    mapper_map_prg_rom(agnes, 0xc000, 16 * 1024, mapper->prg_bank_offsets[1]);
+    mapper_map_chr(agnes, 0x0000, 8 * 1024, 0);
+}
@@ -11,5 +11,6 @@ typedef struct agnes agnes_t;
 AGNES_INTERNAL void mapper0_init(mapper0_t *mapper, agnes_t *agnes);
 AGNES_INTERNAL uint8_t mapper0_read(mapper0_t *mapper, uint16_t addr);
 AGNES_INTERNAL void mapper0_write(mapper0_t *mapper, uint16_t addr, uint8_t val);
+AGNES_INTERNAL void mapper0_map_memory(mapper0_t *mapper);
 
 #endif /* mapper0_h */
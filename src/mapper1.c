@@ -2,6 +2,8 @@
 #include "mapper1.h"
 
 #include "agnes_types.h"
+#include "cpu.h"
+#include "mapper.h"
 #endif
 
 static void mapper1_write_control(mapper1_t *mapper, uint8_t val);
@@ -53,6 +55,7 @@ void mapper1_write(mapper1_t *mapper, uint16_t addr, uint8_t val) {
     if (addr < 0x2000) {
         if (mapper->use_chr_ram) {
             mapper->chr_ram[addr] = val;
+            mapper_decode_chr_row(mapper->agnes, addr);
         }
     } else if (addr >= 0x6000 && addr < 0x8000) {
         mapper->prg_ram[addr - 0x6000] = val;
@@ -83,6 +86,19 @@ void mapper1_write(mapper1_t *mapper, uint16_t addr, uint8_t val) {
     }
 }
 
+void mapper1_map_memory(mapper1_t *mapper) {
+    agnes_t *agnes = mapper->agnes;
+    cpu_map_memory(&agnes->cpu, 0x6000, sizeof(mapper->prg_ram), mapper->prg_ram, mapper->prg_ram);
+    mapper_map_prg_rom(agnes, 0x8000, 16 * 1024, mapper->prg_bank_offsets[0]);
+    mapper_map_prg_rom(agnes, 0xc000, 16 * 1024, mapper->prg_bank_offsets[1]);
+    if (mapper->use_chr_ram) {
+        mapper_map_chr(agnes, 0x0000, 8 * 1024, 0);
+    } else {
+        mapper_map_chr(agnes, 0x0000, 4 * 1024, mapper->chr_bank_offsets[0]);
+        mapper_map_chr(agnes, 0x1000, 4 * 1024, mapper->chr_bank_offsets[1]);
+    }
+}
+
 static void mapper1_write_control(mapper1_t *mapper, uint8_t val) {
     mapper->control = val;
     switch (val & 0x3) {
@@ -91,6 +107,7 @@ static void mapper1_write_control(mapper1_t *mapper, uint8_t val) {
         case 2: mapper->agnes->mirroring_mode = MIRRORING_MODE_VERTICAL; break;
         case 3: mapper->agnes->mirroring_mode = MIRRORING_MODE_HORIZONTAL; break;
     }
+    mapper_map_nametables(mapper->agnes);
     mapper->prg_mode = (val >> 2) & 0x3;
     mapper->chr_mode = (val >> 4) & 0x1;
 }
@@ -126,4 +143,6 @@ static void mapper1_set_offsets(mapper1_t *mapper) {
             break;
         }
     }
+
+    mapper1_map_memory(mapper);
 }
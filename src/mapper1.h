@@ -11,5 +11,6 @@ typedef struct agnes agnes_t;
 AGNES_INTERNAL void mapper1_init(mapper1_t *mapper, agnes_t *agnes);
 AGNES_INTERNAL uint8_t mapper1_read(mapper1_t *mapper, uint16_t addr);
 AGNES_INTERNAL void mapper1_write(mapper1_t *mapper, uint16_t addr, uint8_t val);
+AGNES_INTERNAL void mapper1_map_memory(mapper1_t *mapper);
 
 #endif /* mapper1_h */
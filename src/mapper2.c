@@ -1,6 +1,8 @@
 #ifndef AGNES_AMALGAMATED
 #include "mapper2.h"
 #include "agnes_types.h"
+#include "cpu.h"
+#include "mapper.h"
 #endif
 
 void mapper2_init(mapper2_t *mapper, agnes_t *agnes) {
@@ -26,8 +28,17 @@ uint8_t mapper2_read(mapper2_t *mapper, uint16_t addr) {
 void mapper2_write(mapper2_t *mapper, uint16_t addr, uint8_t val) {
     if (addr < 0x2000) {
         mapper->chr_ram[addr] = val;
+        mapper_decode_chr_row(mapper->agnes, addr);
     } else if (addr >= 0x8000) {
         int bank = val % (mapper->agnes->gamepack.prg_rom_banks_count);
         mapper->prg_bank_offsets[0] = bank * (16 * 1024);
+        mapper2_map_memory(mapper);
     }
 }
+
+void mapper2_map_memory(mapper2_t *mapper) {
+    agnes_t *agnes = mapper->agnes;
+    mapper_map_prg_rom(agnes, 0x8000, 16 * 1024, mapper->prg_bank_offsets[0]);
+    mapper_map_prg_rom(agnes, 0xc000, 16 * 1024, mapper->prg_bank_offsets[1]);
+    mapper_map_chr(agnes, 0x0000, 8 * 1024, 0);
+}
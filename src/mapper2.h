@@ -11,5 +11,6 @@ typedef struct agnes agnes_t;
 AGNES_INTERNAL void mapper2_init(mapper2_t *mapper, agnes_t *agnes);
 AGNES_INTERNAL uint8_t mapper2_read(mapper2_t *mapper, uint16_t addr);
 AGNES_INTERNAL void mapper2_write(mapper2_t *mapper, uint16_t addr, uint8_t val);
+AGNES_INTERNAL void mapper2_map_memory(mapper2_t *mapper);
 
 #endif /* mapper2_h */
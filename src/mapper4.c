@@ -3,6 +3,7 @@
 
 #include "agnes_types.h"
 #include "cpu.h"
+#include "mapper.h"
 #endif
 
 static void mapper4_write_register(mapper4_t *mapper, uint16_t addr, uint8_t val);
@@ -77,6 +78,7 @@ void mapper4_write(mapper4_t *mapper, uint16_t addr, uint8_t val) {
         unsigned addr_offset = addr & 0x3ff;
         unsigned full_offset = (bank_offset + addr_offset) & ((8 * 1024) - 1);
         mapper->chr_ram[full_offset] = val;
+        mapper_decode_chr_row(mapper->agnes, full_offset);
     } else if (addr >= 0x6000 && addr < 0x8000) {
          mapper->prg_ram[addr - 0x6000] = val;
     } else if (addr >= 0x8000) {
@@ -84,6 +86,17 @@ void mapper4_write(mapper4_t *mapper, uint16_t addr, uint8_t val) {
     }
 }
 
+void mapper4_map_memory(mapper4_t *mapper) {
+    agnes_t *agnes = mapper->agnes;
+    cpu_map_memory(&agnes->cpu, 0x6000, sizeof(mapper->prg_ram), mapper->prg_ram, mapper->prg_ram);
+    for (int i = 0; i < 4; i++) {
+        mapper_map_prg_rom(agnes, 0x8000 + (i * 8 * 1024), 8 * 1024, mapper->prg_bank_offsets[i]);
+    }
+    for (int i = 0; i < 8; i++) {
+        mapper_map_chr(agnes, i * 1024, 1024, mapper->chr_bank_offsets[i]);
+    }
+}
+
 static void mapper4_write_register(mapper4_t *mapper, uint16_t addr, uint8_t val) {
     bool addr_odd = addr & 0x1;
     bool addr_even = !addr_odd;
@@ -98,6 +111,7 @@ static void mapper4_write_register(mapper4_t *mapper, uint16_t addr, uint8_t val
     } else if (addr <= 0xbffe && addr_even) { // Mirroring ($A000-$BFFE, even)
         if (mapper->agnes->mirroring_mode != MIRRORING_MODE_FOUR_SCREEN) {
             mapper->agnes->mirroring_mode = (val & 0x1) ? MIRRORING_MODE_HORIZONTAL : MIRRORING_MODE_VERTICAL;
+            mapper_map_nametables(mapper->agnes);
         }
     } else if (addr <= 0xbfff && addr_odd) { // PRG RAM protect ($A001-$BFFF, odd)
         // probably not required (according to https://wiki.nesdev.com/w/index.php/MMC3)
@@ -154,4 +168,6 @@ static void mapper4_set_offsets(mapper4_t *mapper) {
             break;
         }
     }
+
+    mapper4_map_memory(mapper);
 }
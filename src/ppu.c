@@ -10,27 +10,413 @@
 #include "mapper.h"
 #endif
 
-static void scanline_visible_pre(ppu_t *ppu, bool *out_new_frame);
+// Sprite pixels: low bits of the color address ($3F10 - $3F1F), 0 when transparent
+enum {
+    SPRITE_PIXEL_COLOR_MASK = 0x1f,
+    SPRITE_PIXEL_BEHIND_BG  = 1 << 5,
+    SPRITE_PIXEL_ZERO       = 1 << 6
+};
+
+static int get_idle_dots(const ppu_t *ppu);
+static void run_dot(ppu_t *ppu, uint32_t actions, bool *out_new_frame);
+static void render_line(ppu_t *ppu);
+static int get_dots_until(const ppu_t *ppu, int scanline, int dot);
+static int find_sprite_zero_hit(ppu_t *ppu, int scanline);
+static void fetch_nt(ppu_t *ppu);
+static void fetch_at(ppu_t *ppu);
+static void fetch_bg_lo(ppu_t *ppu);
+static void fetch_bg_hi(ppu_t *ppu);
 static void inc_hori_v(ppu_t *ppu);
 static void inc_vert_v(ppu_t *ppu);
-static void emit_pixel(ppu_t *ppu);
+static uint16_t inc_vert(uint16_t v);
+static void emit_pixel(ppu_t *ppu, int x, uint16_t bg_color_addr, uint8_t sprite_pixel);
 static uint16_t get_bg_color_addr(ppu_t *ppu);
-static uint16_t get_sprite_color_addr(ppu_t *ppu, int *out_sprite_ix, bool *out_behind_bg);
+static uint8_t get_sprite_pixel(ppu_t *ppu, int x);
+static void check_sprite_zero_hit(ppu_t *ppu, int x, uint16_t bg_color_addr, uint8_t sprite_pixel);
+static void render_sprite_line(ppu_t *ppu, uint8_t *line, int sprites_count);
+static uint16_t get_sprite_row_pixels(ppu_t *ppu, const sprite_t *sprite, int scanline);
+static uint8_t make_sprite_pixel(const ppu_t *ppu, int i, uint8_t palette_ix);
 static void eval_sprites(ppu_t *ppu);
 static void set_pixel_color_ix(ppu_t *ppu, int x, int y, uint8_t color_ix);
+static void finish_screen_changes(ppu_t *ppu);
+static const chr_row_t* get_chr_row(const ppu_t *ppu, uint16_t addr);
 static uint8_t ppu_read8(ppu_t *ppu, uint16_t addr);
 static void ppu_write8(ppu_t *ppu, uint16_t addr, uint8_t val);
-static uint16_t mirror_address(ppu_t *ppu, uint16_t addr);
 
 static unsigned g_palette_addr_map[32] = {
     0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
     0x00, 0x11, 0x12, 0x13, 0x04, 0x15, 0x16, 0x17, 0x08, 0x19, 0x1a, 0x1b, 0x0c, 0x1d, 0x1e, 0x1f,
 };
 
+// Things done on a dot, most of them only when rendering is enabled
+enum {
+    DOT_EMIT          = 1 << 0,
+    DOT_SHIFT         = 1 << 1,
+    DOT_FETCH_NT      = 1 << 2,
+    DOT_FETCH_AT      = 1 << 3,
+    DOT_FETCH_BG_LO   = 1 << 4,
+    DOT_FETCH_BG_HI   = 1 << 5,
+    DOT_RELOAD        = 1 << 6,
+    DOT_INC_HORI      = 1 << 7,
+    DOT_INC_VERT      = 1 << 8,
+    DOT_COPY_HORI     = 1 << 9,
+    DOT_EVAL_SPRITES  = 1 << 10,
+    DOT_CLEAR_SPRITES = 1 << 11,
+    DOT_COPY_VERT     = 1 << 12,
+    DOT_PA12_BG_LOW   = 1 << 13, // PA12 rises here when background uses the $0000 table
+    DOT_PA12_BG_HIGH  = 1 << 14, // and here when it uses the $1000 one
+    DOT_CLEAR_STATUS  = 1 << 15,
+    DOT_VBLANK        = 1 << 16
+};
+
+enum {
+    LINE_VISIBLE,
+    LINE_VBLANK_START,
+    LINE_PRE,
+    LINE_IDLE, // post-render line and the rest of vblank
+    LINE_KINDS_COUNT
+};
+
+// Kind of every scanline: 0-239 visible, 240 and 242-260 idle, 241 first vblank line, 261 pre-render
+static const uint8_t line_kinds[262] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 1, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 2
+};
+
+// Actions of every dot depend only on the kind of its line and on whether rendering is enabled.
+// With rendering enabled, visible and pre-render lines shift and fetch a tile every 8 dots on dots
+// 1-256 and 321-336 (emitting pixels on dots 1-256 of visible lines), copy horizontal scroll and
+// evaluate or clear sprites on dot 257, copy vertical scroll on dots 280-304 of the pre-render line
+// and raise PA12 on dots 270 and 324. Status is cleared on dot 1 of the pre-render line and vblank
+// starts on dot 1 of line 241 either way. Dots left out are 0.
+static const uint32_t dot_actions[2][LINE_KINDS_COUNT][341] = { // [rendering enabled][line kind][dot]
+    {
+        { // visible line
+            0x0000
+        },
+        { // first vblank line
+            0x0000, 0x10000
+        },
+        { // pre-render line
+            0x0000, 0x8000
+        },
+        { // idle line
+            0x0000
+        }
+    },
+    {
+        { // visible line
+            0x0000, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x00c3, 0x0007, 0x0003, 0x000b, 0x0003, 0x0013, 0x0003, 0x0023,
+            0x0143, 0x0600, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+            0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x2000, 0x0000,
+            0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+            0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+            0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+            0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+            0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+            0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+            0x0000, 0x0006, 0x0002, 0x000a, 0x4002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2
+        },
+        { // first vblank line
+            0x0000, 0x10000
+        },
+        { // pre-render line
+            0x0000, 0x8006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x0142, 0x0a00, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+            0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x2000, 0x0000,
+            0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+            0x1000, 0x1000, 0x1000, 0x1000, 0x1000, 0x1000, 0x1000, 0x1000,
+            0x1000, 0x1000, 0x1000, 0x1000, 0x1000, 0x1000, 0x1000, 0x1000,
+            0x1000, 0x1000, 0x1000, 0x1000, 0x1000, 0x1000, 0x1000, 0x1000,
+            0x1000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+            0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+            0x0000, 0x0006, 0x0002, 0x000a, 0x4002, 0x0012, 0x0002, 0x0022,
+            0x00c2, 0x0006, 0x0002, 0x000a, 0x0002, 0x0012, 0x0002, 0x0022,
+            0x00c2
+        },
+        { // idle line
+            0x0000
+        }
+    }
+};
+
+// First following dot with actions, 341 if none
+static const uint16_t next_action_dots[2][LINE_KINDS_COUNT][341] = {
+    {
+        { // visible line
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341
+        },
+        { // first vblank line
+            1, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341
+        },
+        { // pre-render line
+            1, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341
+        },
+        { // idle line
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341
+        }
+    },
+    {
+        { // visible line
+            1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+            17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32,
+            33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48,
+            49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64,
+            65, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 80,
+            81, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95, 96,
+            97, 98, 99, 100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111, 112,
+            113, 114, 115, 116, 117, 118, 119, 120, 121, 122, 123, 124, 125, 126, 127, 128,
+            129, 130, 131, 132, 133, 134, 135, 136, 137, 138, 139, 140, 141, 142, 143, 144,
+            145, 146, 147, 148, 149, 150, 151, 152, 153, 154, 155, 156, 157, 158, 159, 160,
+            161, 162, 163, 164, 165, 166, 167, 168, 169, 170, 171, 172, 173, 174, 175, 176,
+            177, 178, 179, 180, 181, 182, 183, 184, 185, 186, 187, 188, 189, 190, 191, 192,
+            193, 194, 195, 196, 197, 198, 199, 200, 201, 202, 203, 204, 205, 206, 207, 208,
+            209, 210, 211, 212, 213, 214, 215, 216, 217, 218, 219, 220, 221, 222, 223, 224,
+            225, 226, 227, 228, 229, 230, 231, 232, 233, 234, 235, 236, 237, 238, 239, 240,
+            241, 242, 243, 244, 245, 246, 247, 248, 249, 250, 251, 252, 253, 254, 255, 256,
+            257, 270, 270, 270, 270, 270, 270, 270, 270, 270, 270, 270, 270, 270, 321, 321,
+            321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321,
+            321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321,
+            321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321,
+            321, 322, 323, 324, 325, 326, 327, 328, 329, 330, 331, 332, 333, 334, 335, 336,
+            341, 341, 341, 341, 341
+        },
+        { // first vblank line
+            1, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341
+        },
+        { // pre-render line
+            1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+            17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32,
+            33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48,
+            49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64,
+            65, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 80,
+            81, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95, 96,
+            97, 98, 99, 100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111, 112,
+            113, 114, 115, 116, 117, 118, 119, 120, 121, 122, 123, 124, 125, 126, 127, 128,
+            129, 130, 131, 132, 133, 134, 135, 136, 137, 138, 139, 140, 141, 142, 143, 144,
+            145, 146, 147, 148, 149, 150, 151, 152, 153, 154, 155, 156, 157, 158, 159, 160,
+            161, 162, 163, 164, 165, 166, 167, 168, 169, 170, 171, 172, 173, 174, 175, 176,
+            177, 178, 179, 180, 181, 182, 183, 184, 185, 186, 187, 188, 189, 190, 191, 192,
+            193, 194, 195, 196, 197, 198, 199, 200, 201, 202, 203, 204, 205, 206, 207, 208,
+            209, 210, 211, 212, 213, 214, 215, 216, 217, 218, 219, 220, 221, 222, 223, 224,
+            225, 226, 227, 228, 229, 230, 231, 232, 233, 234, 235, 236, 237, 238, 239, 240,
+            241, 242, 243, 244, 245, 246, 247, 248, 249, 250, 251, 252, 253, 254, 255, 256,
+            257, 270, 270, 270, 270, 270, 270, 270, 270, 270, 270, 270, 270, 270, 280, 280,
+            280, 280, 280, 280, 280, 280, 280, 280, 281, 282, 283, 284, 285, 286, 287, 288,
+            289, 290, 291, 292, 293, 294, 295, 296, 297, 298, 299, 300, 301, 302, 303, 304,
+            321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321, 321,
+            321, 322, 323, 324, 325, 326, 327, 328, 329, 330, 331, 332, 333, 334, 335, 336,
+            341, 341, 341, 341, 341
+        },
+        { // idle line
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341, 341,
+            341, 341, 341, 341, 341
+        }
+    }
+};
+
 void ppu_init(ppu_t *ppu, agnes_t *agnes) {
     memset(ppu, 0, sizeof(ppu_t));
     ppu->agnes = agnes;
 
+    ppu_mark_screen_changed(ppu);
+
     ppu_write_register(ppu, 0x2000, 0);
     ppu_write_register(ppu, 0x2001, 0);
 }
@@ -57,115 +443,250 @@ void ppu_tick(ppu_t *ppu, bool *out_new_frame) {
         }
     }
 
-    if (ppu->dot == 0) {
+    uint32_t actions = dot_actions[rendering_enabled][line_kinds[ppu->scanline]][ppu->dot];
+    if (actions == 0) {
         return;
     }
 
-    bool scanline_visible = ppu->scanline >= 0 && ppu->scanline < 240;
-    bool scanline_pre = ppu->scanline == 261;
-    bool scanline_post = ppu->scanline == 241;
+    // Visible dots are rendered at once on the last one, unless ppu_sync_line renders them earlier
+    if (actions & DOT_EMIT) {
+        if (ppu->dot == 1) {
+            ppu->line_deferred = true;
+        }
+        if (ppu->line_deferred) {
+            if (ppu->dot == 256) {
+                ppu->line_deferred = false;
+                render_line(ppu);
+            }
+            return;
+        }
+    }
+
+    run_dot(ppu, actions, out_new_frame);
+}
+
+// Same as calling ppu_tick dots times, stretches of dots without any actions are skipped at once.
+void ppu_run(ppu_t *ppu, int dots, bool *out_new_frame) {
+    while (dots > 0) {
+        ppu_tick(ppu, out_new_frame);
+        dots--;
 
-    if (rendering_enabled && (scanline_visible || scanline_pre)) {
-        scanline_visible_pre(ppu, out_new_frame);
+        int idle_dots = get_idle_dots(ppu);
+        if (idle_dots > dots) {
+            idle_dots = dots;
+        }
+        if (idle_dots > 0) {
+            int pos = ppu->scanline * 341 + ppu->dot + idle_dots;
+            ppu->scanline = pos / 341;
+            ppu->dot = pos % 341;
+            dots -= idle_dots;
+        }
     }
+}
 
-    if (ppu->dot == 1) {
-        if (scanline_pre) {
-            ppu->status.sprite_overflow = false;
-            ppu->status.sprite_zero_hit = false;
-            ppu->status.in_vblank = false;
-        } else if (scanline_post) {
-            ppu->status.in_vblank = true;
-            *out_new_frame = true;
-            if (ppu->ctrl.nmi_enabled) {
-                cpu_trigger_nmi(&ppu->agnes->cpu);
-            }
+// Number of dots that can be ticked before the PPU does something the CPU can observe without
+// accessing PPU registers: start of vblank (NMI and new frame) and PA12 rises clocking the MMC3 IRQ counter.
+int ppu_dots_until_event(const ppu_t *ppu) {
+    int res = (241 * 341 + 1) - (ppu->scanline * 341 + ppu->dot);
+    if (res <= 0) {
+        res += 262 * 341;
+    }
+
+    if (ppu->masks.show_background && ppu->masks.show_sprites) {
+        int pa12_dot = ppu->ctrl.bg_table_addr == 0x0000 ? 270 : 324;
+        int pa12_res = pa12_dot - ppu->dot;
+        if (pa12_res <= 0) {
+            pa12_res += 341;
+        }
+        if (pa12_res < res) {
+            res = pa12_res;
         }
     }
+
+    return res - 2; // the event dot itself and the dot skipped on odd frames
 }
 
-static void scanline_visible_pre(ppu_t *ppu, bool *out_new_frame) {
-    bool scanline_visible = ppu->scanline >= 0 && ppu->scanline < 240;
-    bool scanline_pre = ppu->scanline == 261;
-    bool dot_visible = ppu->dot > 0 && ppu->dot <= 256;
-    bool dot_fetch = ppu->dot <= 256 || (ppu->dot >= 321 && ppu->dot < 337);
+// Number of dots that can be ticked before reading PPUSTATUS could give something else than now:
+// vblank starting or ending, sprite overflow and the first sprite 0 hit, which is worked out from
+// OAM, scroll, nametables and pattern tables the way lines are going to be rendered. Only holds
+// while nothing is written to the PPU or mapper. Lines with sprites already evaluated are
+// taken to hit on their first dot.
+int ppu_dots_until_status_change(ppu_t *ppu) {
+    int res = get_dots_until(ppu, 241, 1);
+    int pre_res = get_dots_until(ppu, 261, 1);
+    if (pre_res < res) {
+        res = pre_res;
+    }
 
-    if (scanline_visible && dot_visible) {
-        emit_pixel(ppu);
+    if (!ppu->masks.show_background && !ppu->masks.show_sprites) {
+        return res; // sprites aren't evaluated
     }
 
-    if (dot_fetch) {
-        ppu->bg_lo_shift <<= 1;
-        ppu->bg_hi_shift <<= 1;
-        ppu->at_shift = (ppu->at_shift << 2) | (ppu->at_latch & 0x3);
+    const sprite_t *sprites = (const sprite_t*)ppu->oam_data;
+    int sprite_height = ppu->ctrl.use_8x16_sprites ? 16 : 8;
 
-        switch (ppu->dot & 0x7) {
-            case 1: {
-                uint16_t addr = 0x2000 | (ppu->regs.v & 0x0fff);
-                ppu->nt = ppu_read8(ppu, addr);
-                break;
+    if (!ppu->status.sprite_overflow) {
+        uint8_t counts[AGNES_SCREEN_HEIGHT];
+        memset(counts, 0, sizeof(counts));
+        for (int i = 0; i < 64; i++) {
+            if (sprites[i].y_pos > 0xef) {
+                continue;
             }
-            case 3: {
-                uint16_t v = ppu->regs.v;
-                uint16_t addr = 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07);
-                ppu->at = ppu_read8(ppu, addr);
-                if (ppu->regs.v & 0x40) {
-                    ppu->at = ppu->at >> 4;
-                }
-                if (ppu->regs.v & 0x02) {
-                    ppu->at = ppu->at >> 2;
-                }
-                break;
+            for (int s_y = 0; s_y < sprite_height && (sprites[i].y_pos + s_y) < AGNES_SCREEN_HEIGHT; s_y++) {
+                counts[sprites[i].y_pos + s_y]++;
             }
-            case 5: {
-                uint8_t fine_y = ((ppu->regs.v) >> 12) & 0x7;
-                uint16_t addr = ppu->ctrl.bg_table_addr + (ppu->nt << 4) + fine_y;
-                ppu->bg_lo = ppu_read8(ppu, addr);
-                break;
+        }
+        for (int scanline = 0; scanline < AGNES_SCREEN_HEIGHT; scanline++) {
+            int eval_res = get_dots_until(ppu, scanline, 257);
+            if (counts[scanline] > 8 && eval_res < res) {
+                res = eval_res;
             }
-            case 7: {
-                uint8_t fine_y = ((ppu->regs.v) >> 12) & 0x7;
-                uint16_t addr = ppu->ctrl.bg_table_addr + (ppu->nt << 4) + fine_y + 8;
-                ppu->bg_hi = ppu_read8(ppu, addr);
-                break;
+        }
+    }
+
+    if (ppu->status.sprite_zero_hit || !ppu->masks.show_background || !ppu->masks.show_sprites
+     || sprites[0].y_pos > 0xef) {
+        return res;
+    }
+
+    // Sprites evaluated on a line are drawn on the next one
+    bool zero_evaluated = ppu->sprite_ixs_count > 0 && ppu->sprite_ixs[0] == 0;
+    int last_line = sprites[0].y_pos + sprite_height;
+    for (int line = sprites[0].y_pos + 1; line <= last_line && line < AGNES_SCREEN_HEIGHT; line++) {
+        if (ppu->scanline == line && ppu->dot >= 1 && ppu->dot <= 256) {
+            if (zero_evaluated) {
+                return 0;
             }
-            case 0: {
-                ppu->bg_lo_shift = (ppu->bg_lo_shift & 0xff00) | ppu->bg_lo;
-                ppu->bg_hi_shift = (ppu->bg_hi_shift & 0xff00) | ppu->bg_hi;
+            continue;
+        }
 
-                ppu->at_latch = ppu->at & 0x3;
+        int line_res = get_dots_until(ppu, line, 1);
+        if (line_res >= res) {
+            continue;
+        }
+        if (get_dots_until(ppu, line - 1, 257) > line_res) { // evaluated already
+            if (zero_evaluated) {
+                res = line_res;
+            }
+            continue;
+        }
 
-                if (ppu->dot == 256) {
-                    inc_vert_v(ppu);
-                } else {
-                    inc_hori_v(ppu);
-                }
-                break;
+        int x = find_sprite_zero_hit(ppu, line);
+        if (x >= 0) {
+            int hit_res = get_dots_until(ppu, line, x + 1);
+            if (hit_res < res) {
+                res = hit_res;
             }
-            default:
-                break;
+            break;
+        }
+    }
+
+    return res;
+}
+
+// Has to be called before PPU registers, OAM, CHR banks or mirroring are accessed. Renders dots
+// of the current line that were skipped so far one by one and switches the rest of the line to
+// the dot renderer, so that mid-line changes take effect exactly where they happen.
+void ppu_sync_line(ppu_t *ppu) {
+    if (!ppu->line_deferred) {
+        return;
+    }
+    ppu->line_deferred = false;
+
+    int dot = ppu->dot;
+    bool new_frame = false; // can't happen on visible dots
+    for (int i = 1; i <= dot; i++) {
+        ppu->dot = i;
+        run_dot(ppu, dot_actions[1][LINE_VISIBLE][i], &new_frame);
+    }
+    ppu->dot = dot;
+}
+
+// Number of following dots that can be skipped without ticking them one by one
+static int get_idle_dots(const ppu_t *ppu) {
+    if (ppu->line_deferred) {
+        return 255 - ppu->dot; // rendered at once on dot 256
+    }
+
+    bool rendering_enabled = ppu->masks.show_background || ppu->masks.show_sprites;
+    int scanline = ppu->scanline;
+    int dot = ppu->dot;
+    int res = 0;
+    for (;;) {
+        int next_dot = next_action_dots[rendering_enabled][line_kinds[scanline]][dot];
+        if (scanline == 261) {
+            // Leaving dot 339 of the pre-render line may skip a dot and leaving the line starts a new frame
+            if (next_dot > 340) {
+                next_dot = 340;
+            }
+            res += next_dot - dot - 1;
+            return res > 0 ? res : 0;
+        }
+        if (next_dot <= 340) {
+            return res + next_dot - dot - 1;
+        }
+        res += 341 - dot;
+        scanline++;
+        dot = 0;
+    }
+}
+
+static void run_dot(ppu_t *ppu, uint32_t actions, bool *out_new_frame) {
+    if (actions & DOT_EMIT) {
+        int x = ppu->dot - 1;
+        if (ppu->agnes->skip_rendering) {
+            check_sprite_zero_hit(ppu, x, get_bg_color_addr(ppu), get_sprite_pixel(ppu, x));
+        } else {
+            emit_pixel(ppu, x, get_bg_color_addr(ppu), get_sprite_pixel(ppu, x));
+        }
+    }
+
+    if (actions & DOT_SHIFT) {
+        ppu->bg_lo_shift <<= 1;
+        ppu->bg_hi_shift <<= 1;
+        ppu->at_shift = (ppu->at_shift << 2) | (ppu->at_latch & 0x3);
+    }
+
+    if (actions & DOT_FETCH_NT) {
+        fetch_nt(ppu);
+    } else if (actions & DOT_FETCH_AT) {
+        fetch_at(ppu);
+    } else if (actions & DOT_FETCH_BG_LO) {
+        fetch_bg_lo(ppu);
+    } else if (actions & DOT_FETCH_BG_HI) {
+        fetch_bg_hi(ppu);
+    } else if (actions & DOT_RELOAD) {
+        ppu->bg_lo_shift = (ppu->bg_lo_shift & 0xff00) | ppu->bg_lo;
+        ppu->bg_hi_shift = (ppu->bg_hi_shift & 0xff00) | ppu->bg_hi;
+
+        ppu->at_latch = ppu->at & 0x3;
+
+        if (actions & DOT_INC_VERT) {
+            inc_vert_v(ppu);
+        } else {
+            inc_hori_v(ppu);
         }
     }
 
-    if (ppu->dot == 257) {
+    if (actions & DOT_COPY_HORI) {
         // v: |_...|.F..| |...E|DCBA| = t: |_...|.F..| |...E|DCBA|
         ppu->regs.v = (ppu->regs.v & 0xfbe0) | (ppu->regs.t & ~(0xfbe0));
 
-        if (scanline_visible) {
+        if (actions & DOT_EVAL_SPRITES) {
             eval_sprites(ppu);
         } else {
             ppu->sprite_ixs_count = 0;
         }
     }
 
-    if (scanline_pre && ppu->dot >= 280 && ppu->dot <= 304) {
+    if (actions & DOT_COPY_VERT) {
         // v: |_IHG|F.ED| |CBA.|....| = t: |_IHG|F.ED| |CBA.|....|
         ppu->regs.v = (ppu->regs.v & 0x841f) | (ppu->regs.t & ~(0x841f));
     }
 
-    if (ppu->masks.show_background && ppu->masks.show_sprites) {
-        if ((ppu->ctrl.bg_table_addr == 0x0000 && ppu->dot == 270) // Should be 260 but it caused glitches in Kirby
-         || (ppu->ctrl.bg_table_addr == 0x1000 && ppu->dot == 324)) { // Not tested so far.
+    if ((actions & (DOT_PA12_BG_LOW | DOT_PA12_BG_HIGH)) && ppu->masks.show_background && ppu->masks.show_sprites) {
+        if (((actions & DOT_PA12_BG_LOW) && ppu->ctrl.bg_table_addr == 0x0000)
+         || ((actions & DOT_PA12_BG_HIGH) && ppu->ctrl.bg_table_addr == 0x1000)) {
             // https://wiki.nesdev.com/w/index.php/MMC3#IRQ_Specifics
             // PA12 is 12th bit of PPU address bus that's toggled when switching between
             // background and sprite pattern tables (should happen once per scanline).
@@ -174,6 +695,138 @@ static void scanline_visible_pre(ppu_t *ppu, bool *out_new_frame) {
             mapper_pa12_rising_edge(ppu->agnes);
         }
     }
+
+    if (actions & DOT_CLEAR_STATUS) {
+        ppu->status.sprite_overflow = false;
+        ppu->status.sprite_zero_hit = false;
+        ppu->status.in_vblank = false;
+    }
+
+    if (actions & DOT_VBLANK) {
+        ppu->status.in_vblank = true;
+        *out_new_frame = true;
+        finish_screen_changes(ppu);
+        if (ppu->ctrl.nmi_enabled) {
+            cpu_trigger_nmi(&ppu->agnes->cpu);
+        }
+    }
+}
+
+static int get_dots_until(const ppu_t *ppu, int scanline, int dot) {
+    int res = (scanline * 341 + dot) - (ppu->scanline * 341 + ppu->dot);
+    if (res <= 0) {
+        res += 262 * 341 - 1; // the dot skipped on odd frames
+    }
+    return res;
+}
+
+// Same as calling run_dot for dots 1 to 256 of a visible scanline. Shift registers are
+// handled per tile: within a tile the pixels only use bits that were in them at its first dot
+// and the attribute latch, reloads happen after the tile's last pixel. Pattern bits are kept
+// as decoded 2 bit pixels, 16 pixels matching the two bytes of the shift registers.
+static void render_line(ppu_t *ppu) {
+    uint16_t bg_lo_shift = ppu->bg_lo_shift;
+    uint16_t bg_hi_shift = ppu->bg_hi_shift;
+    uint32_t bg_pixels = 0;
+    for (int i = 0; i < 16; i++) {
+        unsigned pixel = ((bg_lo_shift >> i) & 0x1) | (((bg_hi_shift >> i) & 0x1) << 1);
+        bg_pixels |= pixel << (i << 1);
+    }
+    uint16_t at_shift = ppu->at_shift;
+    uint8_t at_latch = ppu->at_latch & 0x3;
+    unsigned fine_x = ppu->regs.x;
+    bool show_background = ppu->masks.show_background;
+    bool show_leftmost_bg = ppu->masks.show_leftmost_bg;
+
+    // When skipping rendering only sprite 0 is drawn, pixels are checked just where it can hit
+    bool skip_rendering = ppu->agnes->skip_rendering;
+    int sprites_count = ppu->sprite_ixs_count;
+    int first_x = 0;
+    int last_x = AGNES_SCREEN_WIDTH - 1;
+    if (skip_rendering) {
+        bool check_zero = sprites_count > 0 && ppu->sprite_ixs[0] == 0 && !ppu->status.sprite_zero_hit;
+        sprites_count = check_zero ? 1 : 0;
+        first_x = check_zero ? ppu->sprites[0].x_pos : (int)AGNES_SCREEN_WIDTH;
+        last_x = first_x + 7;
+    }
+
+    // Nothing sprites depend on can change until the line ends, otherwise it would be rendered dot by dot
+    uint8_t sprite_line[AGNES_SCREEN_WIDTH];
+    render_sprite_line(ppu, sprite_line, sprites_count);
+
+    for (int tile = 0; tile < 32; tile++) {
+        int tile_x = tile << 3;
+        for (unsigned i = 0; i < 8 && (tile_x + 7) >= first_x && tile_x <= last_x; i++) {
+            int x = tile_x + i;
+            unsigned bit = fine_x + i; // 0 - 14, counted from the top of the shift registers
+            uint16_t bg_color_addr = 0;
+            if (show_background && (show_leftmost_bg || x >= 8)) {
+                unsigned palette_ix = (bg_pixels >> (30 - (bit << 1))) & 0x3;
+                if (palette_ix) {
+                    unsigned palette = bit < 8 ? ((at_shift >> (14 - (bit << 1))) & 0x3) : at_latch;
+                    bg_color_addr = 0x3f00 | (palette << 2) | palette_ix;
+                }
+            }
+            if (skip_rendering) {
+                check_sprite_zero_hit(ppu, x, bg_color_addr, sprite_line[x]);
+            } else {
+                emit_pixel(ppu, x, bg_color_addr, sprite_line[x]);
+            }
+        }
+
+        fetch_nt(ppu);
+        fetch_at(ppu);
+        uint8_t fine_y = ((ppu->regs.v) >> 12) & 0x7;
+        const chr_row_t *row = get_chr_row(ppu, ppu->ctrl.bg_table_addr + (ppu->nt << 4) + fine_y);
+        ppu->bg_lo = row->lo;
+        ppu->bg_hi = row->hi;
+
+        bg_lo_shift = (uint16_t)(bg_lo_shift << 8) | ppu->bg_lo;
+        bg_hi_shift = (uint16_t)(bg_hi_shift << 8) | ppu->bg_hi;
+        bg_pixels = (bg_pixels << 16) | row->pixels;
+        at_shift = at_latch * 0x5555; // 8 copies of the latch shifted in
+        at_latch = ppu->at & 0x3;
+
+        if (tile == 31) {
+            inc_vert_v(ppu);
+        } else {
+            inc_hori_v(ppu);
+        }
+    }
+
+    ppu->bg_lo_shift = bg_lo_shift;
+    ppu->bg_hi_shift = bg_hi_shift;
+    ppu->at_shift = at_shift;
+    ppu->at_latch = at_latch;
+}
+
+static void fetch_nt(ppu_t *ppu) {
+    uint16_t addr = ppu->regs.v & 0x0fff;
+    ppu->nt = ppu->nametable_pages[addr >> 10][addr & 0x3ff];
+}
+
+static void fetch_at(ppu_t *ppu) {
+    uint16_t v = ppu->regs.v;
+    uint16_t addr = 0x03C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07);
+    ppu->at = ppu->nametable_pages[addr >> 10][addr & 0x3ff];
+    if (ppu->regs.v & 0x40) {
+        ppu->at = ppu->at >> 4;
+    }
+    if (ppu->regs.v & 0x02) {
+        ppu->at = ppu->at >> 2;
+    }
+}
+
+static void fetch_bg_lo(ppu_t *ppu) {
+    uint8_t fine_y = ((ppu->regs.v) >> 12) & 0x7;
+    uint16_t addr = ppu->ctrl.bg_table_addr + (ppu->nt << 4) + fine_y;
+    ppu->bg_lo = get_chr_row(ppu, addr)->lo;
+}
+
+static void fetch_bg_hi(ppu_t *ppu) {
+    uint8_t fine_y = ((ppu->regs.v) >> 12) & 0x7;
+    uint16_t addr = ppu->ctrl.bg_table_addr + (ppu->nt << 4) + fine_y;
+    ppu->bg_hi = get_chr_row(ppu, addr)->hi;
 }
 
 #define GET_COARSE_X(v) ((v) & 0x1f)
@@ -194,21 +847,75 @@ static void inc_hori_v(ppu_t *ppu) {
 }
 
 static void inc_vert_v(ppu_t *ppu) {
-    unsigned fy = GET_FINE_Y(ppu->regs.v);
+    ppu->regs.v = inc_vert(ppu->regs.v);
+}
+
+static uint16_t inc_vert(uint16_t v) {
+    unsigned fy = GET_FINE_Y(v);
     if (fy < 7) {
-        SET_FINE_Y(ppu->regs.v, fy + 1);
+        SET_FINE_Y(v, fy + 1);
     } else {
-        SET_FINE_Y(ppu->regs.v, 0);
-        unsigned cy = GET_COARSE_Y(ppu->regs.v);
+        SET_FINE_Y(v, 0);
+        unsigned cy = GET_COARSE_Y(v);
         if (cy == 29) {
-            SET_COARSE_Y(ppu->regs.v, 0);
-            ppu->regs.v ^= 0x0800; // switch vertical nametable
+            SET_COARSE_Y(v, 0);
+            v ^= 0x0800; // switch vertical nametable
         } else if (cy == 31) {
-            SET_COARSE_Y(ppu->regs.v, 0);
+            SET_COARSE_Y(v, 0);
         } else {
-            SET_COARSE_Y(ppu->regs.v, cy + 1);
+            SET_COARSE_Y(v, cy + 1);
+        }
+    }
+    return v;
+}
+
+// First x where sprite 0 hits on a line of the frame whose sprites aren't evaluated yet, -1 if there's none
+static int find_sprite_zero_hit(ppu_t *ppu, int scanline) {
+    const sprite_t *sprite = (const sprite_t*)ppu->oam_data;
+    uint16_t sprite_pixels = get_sprite_row_pixels(ppu, sprite, scanline);
+    if (!sprite_pixels) {
+        return -1;
+    }
+
+    // v for the line's tile fetches: vertical increments at dot 256 of each line before it
+    // after the copy from t on the pre-render line, horizontal bits copied from t at dot 257
+    uint16_t v = ppu->regs.v;
+    int increments = scanline - ppu->scanline - (ppu->dot >= 256 ? 1 : 0);
+    if (ppu->scanline >= AGNES_SCREEN_HEIGHT) {
+        v = (ppu->scanline == 261 && ppu->dot >= 304) ? ppu->regs.v : ppu->regs.t;
+        increments = scanline;
+    }
+    for (int i = 0; i < increments; i++) {
+        v = inc_vert(v);
+    }
+    v = (v & 0xfbe0) | (ppu->regs.t & ~(0xfbe0));
+
+    int first_x = (ppu->masks.show_leftmost_bg && ppu->masks.show_leftmost_sprites) ? 0 : 8;
+    for (int s_x = 0; s_x < 8; s_x++) {
+        int x = sprite->x_pos + s_x;
+        if (x >= 255) {
+            break;
+        }
+        if (x < first_x || !((sprite_pixels >> (14 - (s_x << 1))) & 0x3)) {
+            continue;
+        }
+
+        unsigned bg_x = x + ppu->regs.x;
+        uint16_t tile_v = v;
+        unsigned cx = GET_COARSE_X(v) + (bg_x >> 3);
+        if (cx > 31) {
+            tile_v ^= 0x0400; // switch horizontal nametable
+        }
+        SET_COARSE_X(tile_v, cx);
+
+        uint16_t addr = tile_v & 0x0fff;
+        uint8_t nt = ppu->nametable_pages[addr >> 10][addr & 0x3ff];
+        const chr_row_t *row = get_chr_row(ppu, ppu->ctrl.bg_table_addr + (nt << 4) + GET_FINE_Y(tile_v));
+        if ((row->pixels >> (14 - ((bg_x & 0x7) << 1))) & 0x3) {
+            return x;
         }
     }
+    return -1;
 }
 
 #undef GET_COARSE_X
@@ -245,8 +952,7 @@ static void eval_sprites(ppu_t *ppu) {
     }
 }
 
-static void emit_pixel(ppu_t *ppu) {
-    const int x = ppu->dot - 1;
+static void emit_pixel(ppu_t *ppu, int x, uint16_t bg_color_addr, uint8_t sprite_pixel) {
     const int y = ppu->scanline;
 
     if (x < 8 && !ppu->masks.show_leftmost_bg && !ppu->masks.show_leftmost_sprites) {
@@ -254,18 +960,14 @@ static void emit_pixel(ppu_t *ppu) {
         return;
     }
 
-    uint16_t bg_color_addr = get_bg_color_addr(ppu);
-
-    int sprite_ix = -1;
-    bool behind_bg = false;
-    uint16_t sp_color_addr = get_sprite_color_addr(ppu, &sprite_ix, &behind_bg);
+    uint16_t sp_color_addr = sprite_pixel ? (0x3f00 | (sprite_pixel & SPRITE_PIXEL_COLOR_MASK)) : 0;
 
     uint16_t color_addr = 0x3f00;
     if (bg_color_addr && sp_color_addr) {
-        if (sprite_ix == 0 && x != 255) {
+        if ((sprite_pixel & SPRITE_PIXEL_ZERO) && x != 255) {
             ppu->status.sprite_zero_hit = true;
         }
-        color_addr = behind_bg ? bg_color_addr : sp_color_addr;
+        color_addr = (sprite_pixel & SPRITE_PIXEL_BEHIND_BG) ? bg_color_addr : sp_color_addr;
     } else if (bg_color_addr && !sp_color_addr) {
         color_addr = bg_color_addr;
     } else if (!bg_color_addr && sp_color_addr) {
@@ -294,20 +996,12 @@ static uint16_t get_bg_color_addr(ppu_t *ppu) {
     return color_address;
 }
 
-static uint16_t get_sprite_color_addr(ppu_t *ppu, int *out_sprite_ix, bool *out_behind_bg) {
-    *out_sprite_ix = -1;
-    *out_behind_bg = false;
-
-    const int x = ppu->dot - 1;
-    const int y = ppu->scanline;
-
+// Frontmost opaque sprite pixel at x, 0 if there's none
+static uint8_t get_sprite_pixel(ppu_t *ppu, int x) {
     if (!ppu->masks.show_sprites || (!ppu->masks.show_leftmost_sprites && x < 8)) {
         return 0;
     }
 
-    int sprite_height = ppu->ctrl.use_8x16_sprites ? 16 : 8;
-    uint16_t table = ppu->ctrl.sprite_table_addr;
-
     for (int i = 0; i < ppu->sprite_ixs_count; i++) {
         const sprite_t *sprite = &ppu->sprites[i];
         int s_x = x - sprite->x_pos;
@@ -315,59 +1009,105 @@ static uint16_t get_sprite_color_addr(ppu_t *ppu, int *out_sprite_ix, bool *out_
             continue;
         }
 
-        int s_y = y - sprite->y_pos - 1;
-
-        s_x = AGNES_GET_BIT(sprite->attrs, 6) ? 7 - s_x : s_x; // flip hor
-        s_y = AGNES_GET_BIT(sprite->attrs, 7) ? (sprite_height - 1 - s_y) : s_y; // flip vert
+        uint16_t pixels = get_sprite_row_pixels(ppu, sprite, ppu->scanline);
+        if (!pixels) {
+            continue;
+        }
 
-        uint8_t tile_num = sprite->tile_num;
-        if (ppu->ctrl.use_8x16_sprites) {
-            table = tile_num & 0x1 ? 0x1000 : 0x0000;
-            tile_num &= 0xfe;
-            if (s_y >= 8) {
-                tile_num += 1;
-                s_y -= 8;
-            }
+        uint8_t palette_ix = (pixels >> (14 - (s_x << 1))) & 0x3;
+        if (palette_ix) {
+            return make_sprite_pixel(ppu, i, palette_ix);
         }
+    }
+    return 0;
+}
 
-        uint16_t offset = table + (tile_num << 4) + s_y;
+// Same as emit_pixel without drawing, only sprite 0 hits are observable
+static void check_sprite_zero_hit(ppu_t *ppu, int x, uint16_t bg_color_addr, uint8_t sprite_pixel) {
+    if (x < 8 && !ppu->masks.show_leftmost_bg && !ppu->masks.show_leftmost_sprites) {
+        return;
+    }
+    if (bg_color_addr && (sprite_pixel & SPRITE_PIXEL_ZERO) && x != 255) {
+        ppu->status.sprite_zero_hit = true;
+    }
+}
 
-        uint8_t lo_byte = ppu_read8(ppu, offset);
-        uint8_t hi_byte = ppu_read8(ppu, offset + 8);
+// Same as get_sprite_pixel for every x of the line, the first sprites_count sprites are drawn back to front
+static void render_sprite_line(ppu_t *ppu, uint8_t *line, int sprites_count) {
+    memset(line, 0, AGNES_SCREEN_WIDTH);
+    if (!ppu->masks.show_sprites) {
+        return;
+    }
 
-        if (!lo_byte && !hi_byte) {
+    int first_x = ppu->masks.show_leftmost_sprites ? 0 : 8;
+    for (int i = sprites_count - 1; i >= 0; i--) {
+        const sprite_t *sprite = &ppu->sprites[i];
+        uint16_t pixels = get_sprite_row_pixels(ppu, sprite, ppu->scanline);
+        if (!pixels) {
             continue;
         }
 
-        bool lo_bit = AGNES_GET_BIT(lo_byte, 7 - s_x);
-        bool hi_bit = AGNES_GET_BIT(hi_byte, 7 - s_x);
-
-        if (lo_bit || hi_bit) {
-            *out_sprite_ix = ppu->sprite_ixs[i];
-            if (AGNES_GET_BIT(sprite->attrs, 5)) {
-                *out_behind_bg = true;
+        for (int s_x = 0; s_x < 8; s_x++) {
+            int x = sprite->x_pos + s_x;
+            if (x >= AGNES_SCREEN_WIDTH) {
+                break;
+            }
+            uint8_t palette_ix = (pixels >> (14 - (s_x << 1))) & 0x3;
+            if (palette_ix && x >= first_x) {
+                line[x] = make_sprite_pixel(ppu, i, palette_ix);
             }
-            uint8_t palette_ix = ((uint8_t)hi_bit << 1) | (uint8_t)lo_bit;
-            uint16_t color_address = 0x3f10 | ((sprite->attrs & 0x3) << 2) | palette_ix;
-            return color_address;
         }
     }
-    return 0;
+}
+
+// Pattern row of a sprite evaluated for the scanline, flipped horizontally if needed
+static uint16_t get_sprite_row_pixels(ppu_t *ppu, const sprite_t *sprite, int scanline) {
+    int sprite_height = ppu->ctrl.use_8x16_sprites ? 16 : 8;
+    uint16_t table = ppu->ctrl.sprite_table_addr;
+
+    int s_y = scanline - sprite->y_pos - 1;
+
+    s_y = AGNES_GET_BIT(sprite->attrs, 7) ? (sprite_height - 1 - s_y) : s_y; // flip vert
+
+    uint8_t tile_num = sprite->tile_num;
+    if (ppu->ctrl.use_8x16_sprites) {
+        table = tile_num & 0x1 ? 0x1000 : 0x0000;
+        tile_num &= 0xfe;
+        if (s_y >= 8) {
+            tile_num += 1;
+            s_y -= 8;
+        }
+    }
+
+    uint16_t offset = table + (tile_num << 4) + s_y;
+    const chr_row_t *row = NULL;
+    chr_row_t misaligned_row;
+    if (s_y >= 0 && s_y < 8) {
+        row = get_chr_row(ppu, offset);
+    } else { // on the sprite's first line planes come from neighbouring rows
+        ppu_decode_chr_row(&misaligned_row, ppu_read8(ppu, offset), ppu_read8(ppu, offset + 8));
+        row = &misaligned_row;
+    }
+    return AGNES_GET_BIT(sprite->attrs, 6) ? row->pixels_flipped : row->pixels; // flip hor
+}
+
+static uint8_t make_sprite_pixel(const ppu_t *ppu, int i, uint8_t palette_ix) {
+    const sprite_t *sprite = &ppu->sprites[i];
+    uint8_t res = 0x10 | ((sprite->attrs & 0x3) << 2) | palette_ix; // low bits of the color address
+    if (AGNES_GET_BIT(sprite->attrs, 5)) {
+        res |= SPRITE_PIXEL_BEHIND_BG;
+    }
+    if (ppu->sprite_ixs[i] == 0) {
+        res |= SPRITE_PIXEL_ZERO;
+    }
+    return res;
 }
 
 uint8_t ppu_read_register(ppu_t *ppu, uint16_t addr) {
+    ppu_sync_line(ppu);
     switch (addr) {
         case 0x2002: { // PPUSTATUS
-            uint8_t res = 0;
-            res |= ppu->last_reg_write & 0x1f;
-            res |= ppu->status.sprite_overflow << 5;
-            res |= ppu->status.sprite_zero_hit << 6;
-            res |= ppu->status.in_vblank << 7;
-            ppu->status.in_vblank = false;
-            //    res |= ppu->status_in_vblank
-            //    w:                  = 0
-            ppu->regs.w = 0;
-            return res;
+            return ppu_read_status(ppu);
         }
         case 0x2004: { // OAMDATA
             return ppu->oam_data[ppu->oam_address];
@@ -388,7 +1128,22 @@ uint8_t ppu_read_register(ppu_t *ppu, uint16_t addr) {
     return 0;
 }
 
+// PPUSTATUS without syncing the line, for reads ahead of the PPU while the status can't change
+uint8_t ppu_read_status(ppu_t *ppu) {
+    uint8_t res = 0;
+    res |= ppu->last_reg_write & 0x1f;
+    res |= ppu->status.sprite_overflow << 5;
+    res |= ppu->status.sprite_zero_hit << 6;
+    res |= ppu->status.in_vblank << 7;
+    ppu->status.in_vblank = false;
+    //    res |= ppu->status_in_vblank
+    //    w:                  = 0
+    ppu->regs.w = 0;
+    return res;
+}
+
 void ppu_write_register(ppu_t *ppu, uint16_t addr, uint8_t val) {
+    ppu_sync_line(ppu);
     ppu->last_reg_write = val;
     switch (addr) {
         case 0x2000: { // PPUCTRL
@@ -459,11 +1214,18 @@ void ppu_write_register(ppu_t *ppu, uint16_t addr, uint8_t val) {
             break;
         }
         case 0x4014: { // OAMDMA
-            uint16_t dma_addr = ((uint16_t)val) << 8;
-            for (int i = 0; i < 256; i++) {
-                ppu->oam_data[ppu->oam_address] = cpu_read8(&ppu->agnes->cpu, dma_addr);
-                ppu->oam_address++;
-                dma_addr++;
+            const uint8_t *page = ppu->agnes->cpu.read_pages[val];
+            if (page) { // ram or rom, oam_address wraps around to where it started
+                unsigned first_size = 256 - ppu->oam_address;
+                memcpy(ppu->oam_data + ppu->oam_address, page, first_size);
+                memcpy(ppu->oam_data, page + first_size, ppu->oam_address);
+            } else {
+                uint16_t dma_addr = ((uint16_t)val) << 8;
+                for (int i = 0; i < 256; i++) {
+                    ppu->oam_data[ppu->oam_address] = cpu_read8(&ppu->agnes->cpu, dma_addr);
+                    ppu->oam_address++;
+                    dma_addr++;
+                }
             }
             cpu_set_dma_stall(&ppu->agnes->cpu);
             break;
@@ -473,7 +1235,50 @@ void ppu_write_register(ppu_t *ppu, uint16_t addr, uint8_t val) {
 
 static void set_pixel_color_ix(ppu_t *ppu, int x, int y, uint8_t color_ix) {
     int ix = (y * AGNES_SCREEN_WIDTH) + x;
-    ppu->screen_buffer[ix] = color_ix;
+    uint8_t val = color_ix & 0x3f; // palette ram keeps all 8 bits written to it
+    ppu->agnes->screen_changes.lines_drawn[y] |= ppu->screen_buffer[ix] ^ val;
+    ppu->screen_buffer[ix] = val;
+}
+
+// Every line is reported as changed at the end of the frame
+void ppu_mark_screen_changed(ppu_t *ppu) {
+    screen_changes_t *changes = &ppu->agnes->screen_changes;
+    memset(changes->lines_drawn, 1, sizeof(changes->lines_drawn));
+}
+
+// Called when a frame ends, hashes are only updated for lines that changed
+static void finish_screen_changes(ppu_t *ppu) {
+    screen_changes_t *changes = &ppu->agnes->screen_changes;
+    for (int y = 0; y < AGNES_SCREEN_HEIGHT; y++) {
+        changes->lines_changed[y] = changes->lines_drawn[y] != 0;
+        if (!changes->lines_changed[y]) {
+            continue;
+        }
+        const uint8_t *line = ppu->screen_buffer + (y * AGNES_SCREEN_WIDTH);
+        uint32_t hash = 2166136261u; // FNV-1a
+        for (int x = 0; x < AGNES_SCREEN_WIDTH; x++) {
+            hash = (hash ^ line[x]) * 16777619u;
+        }
+        changes->line_hashes[y] = hash;
+    }
+    memset(changes->lines_drawn, 0, sizeof(changes->lines_drawn));
+}
+
+void ppu_decode_chr_row(chr_row_t *row, uint8_t lo, uint8_t hi) {
+    row->lo = lo;
+    row->hi = hi;
+    row->pixels = 0;
+    row->pixels_flipped = 0;
+    for (int i = 0; i < 8; i++) {
+        unsigned pixel = ((lo >> (7 - i)) & 0x1) | (((hi >> (7 - i)) & 0x1) << 1);
+        row->pixels |= pixel << (14 - (i << 1));
+        row->pixels_flipped |= pixel << (i << 1);
+    }
+}
+
+// addr of the row's low plane byte in $0000 - $1FFF
+static const chr_row_t* get_chr_row(const ppu_t *ppu, uint16_t addr) {
+    return &ppu->chr_pages[(addr >> 10) & 0x7][((addr & 0x3f0) >> 1) | (addr & 0x7)];
 }
 
 static uint8_t ppu_read8(ppu_t *ppu, uint16_t addr) {
@@ -485,8 +1290,7 @@ static uint8_t ppu_read8(ppu_t *ppu, uint16_t addr) {
     } else if (addr < 0x2000) { // $0000 - $1FFF
         res = mapper_read(ppu->agnes, addr);
     } else { // $2000 - $3EFF
-        uint16_t mirrored_addr = mirror_address(ppu, addr);
-        res = ppu->nametables[mirrored_addr];
+        res = ppu->nametable_pages[(addr >> 10) & 0x3][addr & 0x3ff];
     }
     return res;
 }
@@ -499,19 +1303,6 @@ static void ppu_write8(ppu_t *ppu, uint16_t addr, uint8_t val) {
     } else if (addr < 0x2000) { // $0000 - $1FFF
         mapper_write(ppu->agnes, addr, val);
     } else { // $2000 - $3EFF
-        uint16_t mirrored_addr = mirror_address(ppu, addr);
-        ppu->nametables[mirrored_addr] = val;
-    }
-}
-
-static uint16_t mirror_address(ppu_t *ppu, uint16_t addr) {
-    switch (ppu->agnes->mirroring_mode)
-    {
-        case MIRRORING_MODE_HORIZONTAL:   return ((addr >> 1) & 0x400) | (addr & 0x3ff);
-        case MIRRORING_MODE_VERTICAL:     return addr & 0x07ff;
-        case MIRRORING_MODE_SINGLE_LOWER: return addr & 0x3ff;
-        case MIRRORING_MODE_SINGLE_UPPER: return 0x400 | (addr & 0x3ff);
-        case MIRRORING_MODE_FOUR_SCREEN:  return addr - 0x2000;
-        default: return 0;
+        ppu->nametable_pages[(addr >> 10) & 0x3][addr & 0x3ff] = val;
     }
 }
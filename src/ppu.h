@@ -7,10 +7,18 @@
 
 typedef struct agnes agnes_t;
 typedef struct ppu ppu_t;
+typedef struct chr_row chr_row_t;
 
 AGNES_INTERNAL void ppu_init(ppu_t *ppu, agnes_t *agnes);
 AGNES_INTERNAL void ppu_tick(ppu_t *ppu, bool *out_new_frame);
+AGNES_INTERNAL void ppu_run(ppu_t *ppu, int dots, bool *out_new_frame);
 AGNES_INTERNAL uint8_t ppu_read_register(ppu_t *ppu, uint16_t reg);
+AGNES_INTERNAL uint8_t ppu_read_status(ppu_t *ppu);
 AGNES_INTERNAL void ppu_write_register(ppu_t *ppu, uint16_t addr, uint8_t val);
+AGNES_INTERNAL int ppu_dots_until_event(const ppu_t *ppu);
+AGNES_INTERNAL int ppu_dots_until_status_change(ppu_t *ppu);
+AGNES_INTERNAL void ppu_sync_line(ppu_t *ppu);
+AGNES_INTERNAL void ppu_mark_screen_changed(ppu_t *ppu);
+AGNES_INTERNAL void ppu_decode_chr_row(chr_row_t *row, uint8_t lo, uint8_t hi);
 
 #endif /* ppu_h */
@@ -0,0 +1,79 @@
+#ifndef AGNES_AMALGAMATED
+#include "scheduler.h"
+
+#include "agnes_types.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#endif
+
+// In scheduled mode the CPU runs ahead of the PPU and APU until the next PPU event that can
+// interrupt it (vblank NMI or MMC3 IRQ clock). Cycles are only counted and the PPU and APU catch up
+// in bulk at the end, or earlier when the CPU accesses their registers or mapper registers.
+// Because an instruction's memory accesses happen before its own cycles are ticked, catching up
+// before an access gives the same state the interpreter would see. A run ends after any instruction
+// that caused a catch up, since register writes can change the next event or trigger a DMA stall.
+// Sprite 0 hits and APU frame IRQs are only observable through register reads, which catch up,
+// except for PPUSTATUS reads happening before the status can change, which don't end the run
+// so that polling for a sprite 0 hit doesn't cut runs short.
+
+int scheduler_run(agnes_t *agnes, bool *out_new_frame) {
+    cpu_t *cpu = &agnes->cpu;
+    scheduler_t *scheduler = &agnes->scheduler;
+    if (cpu->stall > 0) {
+        return 0;
+    }
+
+    int max_dots = ppu_dots_until_event(&agnes->ppu);
+    int cycles = 0;
+    scheduler->synced = false;
+    scheduler->new_frame = false;
+    scheduler->status_predicted = false;
+    // An instruction can start as long as the event didn't happen yet, the one during which it
+    // happens ends the run like it would end a tick in interpreter mode.
+    while ((cycles * 3) < max_dots) {
+        int ins_cycles = cpu_tick(cpu);
+        if (ins_cycles == 0) {
+            break;
+        }
+        cycles += ins_cycles;
+        scheduler->pending_cycles += ins_cycles;
+        if (scheduler->synced || cpu->interrupt != INTERRPUT_NONE || cpu->stall > 0) {
+            break;
+        }
+    }
+    scheduler_catch_up(agnes);
+
+    if (scheduler->new_frame) {
+        *out_new_frame = true;
+    }
+    return cycles;
+}
+
+// Called before accessing PPU, APU and mapper registers, does nothing outside of scheduler_run
+void scheduler_catch_up(agnes_t *agnes) {
+    scheduler_t *scheduler = &agnes->scheduler;
+    int cycles = scheduler->pending_cycles;
+    scheduler->synced = true;
+    scheduler->status_predicted = false; // registers are going to be accessed
+    if (cycles == 0) {
+        return;
+    }
+    scheduler->pending_cycles = 0; // DMC reads can go through the slow path and get here again
+
+    ppu_run(&agnes->ppu, cycles * 3, &scheduler->new_frame);
+    apu_run(&agnes->apu, cycles);
+}
+
+// True if PPUSTATUS can be read without catching up, status predictions hold until the next catch up
+bool scheduler_can_read_status(agnes_t *agnes) {
+    scheduler_t *scheduler = &agnes->scheduler;
+    if (scheduler->pending_cycles == 0) {
+        return false;
+    }
+    if (!scheduler->status_predicted) {
+        scheduler->status_dots = ppu_dots_until_status_change(&agnes->ppu);
+        scheduler->status_predicted = true;
+    }
+    return (scheduler->pending_cycles * 3) < scheduler->status_dots;
+}
@@ -0,0 +1,14 @@
+#ifndef scheduler_h
+#define scheduler_h
+
+#ifndef AGNES_AMALGAMATED
+#include "common.h"
+#endif
+
+typedef struct agnes agnes_t;
+
+AGNES_INTERNAL int scheduler_run(agnes_t *agnes, bool *out_new_frame);
+AGNES_INTERNAL void scheduler_catch_up(agnes_t *agnes);
+AGNES_INTERNAL bool scheduler_can_read_status(agnes_t *agnes);
+
+#endif /* scheduler_h */
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
@@ -53,6 +54,8 @@ static bool play_game(const char *ines_path, const char *rec_path, int max_frame
 static bool g_vsync = false;
 static bool g_render = true;
 static int  g_frame_skip = 1;
+static bool g_lockstep = false;
+static bool g_fusion_stats = false;
 
 player_mode_t g_mode = PLAYER_MODE_VERIFY;
 
@@ -76,6 +79,10 @@ int player_main(int argc, char **argv) {
 
     kgflags_int("frame-skip", 1, "Render every n-th frame.", false, &g_frame_skip);
 
+    kgflags_bool("lockstep", false, "Run emulators in block cpu mode with idle loop skipping and in scheduled cpu mode, compare states after every frame.", false, &g_lockstep);
+
+    kgflags_bool("fusion-stats", false, "Print how many times fused instruction sequences ran in the lockstep emulator.", false, &g_fusion_stats);
+
     const char *mode_str = NULL;
     kgflags_string("mode", NULL, "Mode (verify or update)", true, &mode_str);
 
@@ -150,6 +157,26 @@ static bool play_game(const char *game_path, const char *rec_path, int max_frame
         return false;
     }
 
+    agnes_t *lockstep_agnes = NULL;
+    agnes_t *scheduled_agnes = NULL;
+    agnes_state_t *state = NULL;
+    agnes_state_t *lockstep_state = NULL;
+    if (g_lockstep) {
+        agnes_config_t config = { .cpu_mode = AGNES_CPU_MODE_BLOCKS, .skip_idle_loops = true };
+        lockstep_agnes = agnes_make_with_config(&config);
+        assert(lockstep_agnes);
+        ok = agnes_load_ines_data(lockstep_agnes, ines_data, ines_data_size);
+        assert(ok);
+        agnes_config_t scheduled_config = { .cpu_mode = AGNES_CPU_MODE_SCHEDULED, .skip_idle_loops = false };
+        scheduled_agnes = agnes_make_with_config(&scheduled_config);
+        assert(scheduled_agnes);
+        ok = agnes_load_ines_data(scheduled_agnes, ines_data, ines_data_size);
+        assert(ok);
+        state = (agnes_state_t*)malloc(agnes_state_size());
+        lockstep_state = (agnes_state_t*)malloc(agnes_state_size());
+        assert(state && lockstep_state);
+    }
+
     JSON_Value *recording_val = json_parse_file(rec_path);
     if (!recording_val) {
         printf("Parsing recording failed: %s\n", rec_path);
@@ -170,6 +197,12 @@ static bool play_game(const char *game_path, const char *rec_path, int max_frame
 
     bool update_recording = false;
 
+    uint32_t line_hashes[AGNES_SCREEN_HEIGHT]; // of each line's pixels as if the hash started from 0
+    uint32_t line_hash_factor = 1;
+    for (int i = 0; i < AGNES_SCREEN_WIDTH * (int)sizeof(uint32_t); i++) {
+        line_hash_factor *= 33;
+    }
+
     bool result_ok = true;
     while (true) {
         bool quit = check_sdl_quit_event();
@@ -201,14 +234,46 @@ static bool play_game(const char *game_path, const char *rec_path, int max_frame
             }
         }
 
-        uint32_t current_pixels_hash = DJB2_INITIAL_HASH;
+        if (lockstep_agnes) {
+            agnes_set_input(lockstep_agnes, &input_1, &input_2);
+            ok = agnes_next_frame(lockstep_agnes);
+            assert(ok);
+            agnes_dump_state(agnes, state);
+            agnes_dump_state(lockstep_agnes, lockstep_state);
+            if (memcmp(state, lockstep_state, agnes_state_size()) != 0) {
+                printf("Lockstep mismatch at frame: %d\n", frame_number);
+                result_ok = false;
+                break;
+            }
 
+            agnes_set_input(scheduled_agnes, &input_1, &input_2);
+            ok = agnes_next_frame(scheduled_agnes);
+            assert(ok);
+            agnes_dump_state(scheduled_agnes, lockstep_state);
+            if (memcmp(state, lockstep_state, agnes_state_size()) != 0) {
+                printf("Scheduled lockstep mismatch at frame: %d\n", frame_number);
+                result_ok = false;
+                break;
+            }
+        }
+
+        static uint32_t pixels[AGNES_SCREEN_HEIGHT * AGNES_SCREEN_WIDTH];
+        agnes_get_screen_rgba(agnes, pixels, AGNES_SCREEN_WIDTH * sizeof(uint32_t), AGNES_PIXEL_FORMAT_ARGB8888);
+
+        // djb2 is h * 33 + byte, so a line adds (h * 33^bytes) + its hash started from 0,
+        // which only has to be recomputed for lines that changed.
+        const uint8_t *changed_lines = agnes_get_changed_lines(agnes);
+        uint32_t current_pixels_hash = DJB2_INITIAL_HASH;
         for (int y = 0; y < AGNES_SCREEN_HEIGHT; y++) {
+            if (changed_lines[y]) {
+                line_hashes[y] = 0;
+                for (int x = 0; x < AGNES_SCREEN_WIDTH; x++) {
+                    line_hashes[y] = djb2_hash_incremental(line_hashes[y], pixels[(y * AGNES_SCREEN_WIDTH) + x]);
+                }
+            }
+            current_pixels_hash = (current_pixels_hash * line_hash_factor) + line_hashes[y];
             for (int x = 0; x < AGNES_SCREEN_WIDTH; x++) {
-                agnes_color_t c = agnes_get_screen_pixel(agnes, x, y);
-                uint32_t c_val = c.a << 24 | c.r << 16 | c.g << 8 | c.b;
-                set_sdl_pixel(x, y, c_val, frame_number);
-                current_pixels_hash = djb2_hash_incremental(current_pixels_hash, c_val);
+                set_sdl_pixel(x, y, pixels[(y * AGNES_SCREEN_WIDTH) + x], frame_number);
             }
         }
 
@@ -238,7 +303,19 @@ static bool play_game(const char *game_path, const char *rec_path, int max_frame
         frame_number++;
     }
     
+    if (g_fusion_stats && lockstep_agnes) {
+        agnes_fusion_stat_t stats[64];
+        int stats_count = agnes_get_fusion_stats(lockstep_agnes, stats, 64);
+        for (int i = 0; i < stats_count && i < 64; i++) {
+            printf("%-24s %llu\n", stats[i].name, (unsigned long long)stats[i].count);
+        }
+    }
+
     agnes_destroy(agnes);
+    agnes_destroy(lockstep_agnes);
+    agnes_destroy(scheduled_agnes);
+    free(state);
+    free(lockstep_state);
 
     if (update_recording) {
         printf("Updating recording %s\n", rec_path);
@@ -124,13 +124,11 @@ int recorder_main(int argc, char **argv) {
 
         uint32_t pixels_hash = DJB2_INITIAL_HASH;
         uint32_t *pixels = (uint32_t*)surface->pixels;
+        agnes_get_screen_rgba(agnes, pixels, surface->pitch, AGNES_PIXEL_FORMAT_ARGB8888);
         for (int y = 0; y < AGNES_SCREEN_HEIGHT; y++) {
             for (int x = 0; x < AGNES_SCREEN_WIDTH; x++) {
-                agnes_color_t c = agnes_get_screen_pixel(agnes, x, y);
-                int ix = (y * AGNES_SCREEN_WIDTH) + x;
-                uint32_t c_val = c.a << 24 | c.r << 16 | c.g << 8 | c.b;
-                pixels[ix] = c_val;
-                pixels_hash = djb2_hash_incremental(pixels_hash, c_val);
+                int ix = (y * (surface->pitch / 4)) + x;
+                pixels_hash = djb2_hash_incremental(pixels_hash, pixels[ix]);
             }
         }
 
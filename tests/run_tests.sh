@@ -58,7 +58,7 @@ if [ "${PLAYER_COMPILED}" == true ]; then
 	START=$(date +%s)
 
 	for f in recs/*.json; do 
-		./player --recordings "$f" --roms-dir "${ROM_DIR}" --mode verify --no-vsync --frame-skip 10 --no-render
+		./player --recordings "$f" --roms-dir "${ROM_DIR}" --mode verify --no-vsync --frame-skip 10 --no-render --lockstep
 		if [ ${?} != "0" ]; then
 			TESTS_OK=false
 		fi
@@ -0,0 +1,305 @@
+#!/usr/bin/python
+
+# Statically recompiles PRG-ROM code of an iNES image into C.
+#
+# Code reachable from RESET/NMI/IRQ vectors is split into blocks that follow the same rules as
+# block execution in src/blocks.c (no I/O or mapper register accesses, no indirect addressing,
+# a block ends after any jump, branch, call or return). Each block becomes a C function executing
+# its instructions with constant operands. Blocks are keyed by their PRG-ROM offset, so banks that
+# could be mapped into switchable windows are all walked and everything else (code in RAM, unknown
+# jump targets) is left to the interpreter.
+#
+# The output has to be compiled instead of agnes.c (it includes it):
+#   utils/recompile.py --input game.nes --output game_static.c --name game
+# and enabled after loading the game:
+#   const agnes_static_code_t* agnes_static_code_game(void);
+#   agnes_set_static_code(agnes, agnes_static_code_game());
+
+import argparse
+import os
+import re
+
+INES_HEADER_SIZE = 16
+
+# Has to stay below BLOCK_MAX_CYCLES in src/blocks.c, blocks only run if they fit before the next PPU event
+BLOCK_MAX_CYCLES = 96
+MAX_BLOCKS = 0xffff
+
+MODE_SIZES = {
+    "ADDR_MODE_NONE": 0,
+    "ADDR_MODE_ABSOLUTE": 3,
+    "ADDR_MODE_ABSOLUTE_X": 3,
+    "ADDR_MODE_ABSOLUTE_Y": 3,
+    "ADDR_MODE_ACCUMULATOR": 1,
+    "ADDR_MODE_IMMEDIATE": 2,
+    "ADDR_MODE_IMPLIED": 1,
+    "ADDR_MODE_IMPLIED_BRK": 2,
+    "ADDR_MODE_INDIRECT": 3,
+    "ADDR_MODE_INDIRECT_X": 2,
+    "ADDR_MODE_INDIRECT_Y": 2,
+    "ADDR_MODE_RELATIVE": 2,
+    "ADDR_MODE_ZERO_PAGE": 2,
+    "ADDR_MODE_ZERO_PAGE_X": 2,
+    "ADDR_MODE_ZERO_PAGE_Y": 2,
+}
+
+WRITING_OPS = ["op_sta", "op_stx", "op_sty", "op_inc", "op_dec", "op_asl", "op_lsr", "op_rol", "op_ror"]
+
+OPCODE_JMP = 0x4c
+OPCODE_JSR = 0x20
+OPCODE_RTS = 0x60
+OPCODE_RTI = 0x40
+
+class Instruction:
+    def __init__(self, opcode, name, cycles, page_cross_cycle, op, mode):
+        self.opcode = opcode
+        self.name = name
+        self.cycles = cycles
+        self.page_cross_cycle = page_cross_cycle
+        self.op = op
+        self.mode = mode
+        self.size = MODE_SIZES[mode]
+
+def parse_instructions(path):
+    regex = r'INS\((0x[0-9a-fA-F]{2}), "(\w+)", (\d+), (true|false), (\w+), (\w+)\)'
+    with open(path, "r") as f:
+        source = f.read()
+    res = {}
+    for match in re.finditer(regex, source):
+        opcode = int(match.group(1), 16)
+        res[opcode] = Instruction(opcode, match.group(2), int(match.group(3)), match.group(4) == "true", match.group(5), match.group(6))
+    if len(res) == 0:
+        raise Exception("No instructions found in " + path)
+    return res
+
+class Recompiler:
+    def __init__(self, data, instructions):
+        if data[0:4] != b"NES\x1a":
+            raise Exception("Not an iNES file")
+        prg_rom_offset = INES_HEADER_SIZE
+        if data[6] & 0x4:
+            prg_rom_offset += 512
+        self.prg_rom = data[prg_rom_offset:prg_rom_offset + data[4] * 16 * 1024]
+        self.mapper = ((data[6] & 0xf0) >> 4) | (data[7] & 0xf0)
+        if self.mapper not in [0, 1, 2, 4]:
+            raise Exception("Unsupported mapper: " + str(self.mapper))
+        self.instructions = instructions
+        self.blocks = {} # prg rom offset -> (cpu address, instructions, max cycles, writes prg-ram)
+        self.visited = set()
+
+    # All PRG-ROM offsets that could be mapped at a cpu address
+    def get_prg_rom_offsets(self, addr):
+        size = len(self.prg_rom)
+        if addr < 0x8000 or size == 0:
+            return []
+        if self.mapper == 0:
+            return [(addr - 0x8000) % size]
+        elif self.mapper == 1 or self.mapper == 2:
+            if addr >= 0xc000:
+                return [size - 0x4000 + (addr & 0x3fff)]
+            return [bank + (addr & 0x3fff) for bank in range(0, size, 0x4000)]
+        elif self.mapper == 4:
+            if addr >= 0xe000:
+                return [size - 0x2000 + (addr & 0x1fff)]
+            return [bank + (addr & 0x1fff) for bank in range(0, size, 0x2000)]
+
+    # Jump targets in the same 8KB window are in the same bank
+    def get_target_offsets(self, offset, addr, target):
+        if target >= 0x8000 and (target >> 13) == (addr >> 13):
+            return [offset - (addr & 0x1fff) + (target & 0x1fff)]
+        return self.get_prg_rom_offsets(target)
+
+    def read16(self, addr):
+        offsets = self.get_prg_rom_offsets(addr)
+        if len(offsets) != 1 or offsets[0] + 1 >= len(self.prg_rom):
+            return None
+        return self.prg_rom[offsets[0]] | (self.prg_rom[offsets[0] + 1] << 8)
+
+    def is_read_safe(self, addr, size):
+        last = addr + size - 1
+        if last > 0xffff:
+            return True
+        return last < 0x2000 or addr >= 0x4020
+
+    def is_write_safe(self, addr, size):
+        last = addr + size - 1
+        if last > 0xffff:
+            return False
+        def is_ram(a):
+            return a < 0x2000 or (self.mapper in [1, 4] and self.is_prg_ram(a))
+        return is_ram(addr) and is_ram(last)
+
+    # Same as BLOCK_FLAG_PRG_RAM in src/blocks.c, blocks writing there only run while PRG-RAM is mapped
+    def is_prg_ram(self, addr):
+        return addr >= 0x6000 and addr < 0x8000
+
+    def writes_prg_ram(self, ins, operand):
+        writes = ins.op in WRITING_OPS and ins.mode != "ADDR_MODE_ACCUMULATOR"
+        if not writes or ins.mode not in ["ADDR_MODE_ABSOLUTE", "ADDR_MODE_ABSOLUTE_X", "ADDR_MODE_ABSOLUTE_Y"]:
+            return False
+        return self.is_prg_ram(operand)
+
+    def is_safe(self, ins, operand):
+        writes = ins.op in WRITING_OPS and ins.mode != "ADDR_MODE_ACCUMULATOR"
+        if ins.mode in ["ADDR_MODE_ACCUMULATOR", "ADDR_MODE_IMMEDIATE", "ADDR_MODE_IMPLIED", "ADDR_MODE_RELATIVE",
+                        "ADDR_MODE_ZERO_PAGE", "ADDR_MODE_ZERO_PAGE_X", "ADDR_MODE_ZERO_PAGE_Y"]:
+            return True
+        elif ins.mode == "ADDR_MODE_ABSOLUTE":
+            if ins.opcode in [OPCODE_JMP, OPCODE_JSR]:
+                return True
+            return self.is_read_safe(operand, 1) and (not writes or self.is_write_safe(operand, 1))
+        elif ins.mode in ["ADDR_MODE_ABSOLUTE_X", "ADDR_MODE_ABSOLUTE_Y"]:
+            return self.is_read_safe(operand, 0x100) and (not writes or self.is_write_safe(operand, 0x100))
+        return False
+
+    def walk(self, vectors):
+        queue = []
+        for vector in vectors:
+            addr = self.read16(vector)
+            if addr is not None:
+                queue += [(offset, addr) for offset in self.get_prg_rom_offsets(addr)]
+
+        while len(queue) > 0 and len(self.blocks) < MAX_BLOCKS:
+            offset, addr = queue.pop(0)
+            if offset in self.visited or offset >= len(self.prg_rom):
+                continue
+            self.visited.add(offset)
+            queue += self.build_block(offset, addr)
+
+    # Returns offsets and addresses of code reachable from the block
+    def build_block(self, start_offset, start_addr):
+        offset = start_offset
+        addr = start_addr
+        block = []
+        cycles = 0
+        prg_ram = False
+        successors = []
+        while True:
+            ins = self.instructions.get(self.prg_rom[offset])
+            if ins is None:
+                break
+            end = offset + ins.size - 1
+            if end >= len(self.prg_rom) or (end >> 13) != (offset >> 13):
+                break
+            if ins.size == 3:
+                operand = self.prg_rom[offset + 1] | (self.prg_rom[offset + 2] << 8)
+            elif ins.size == 2 and ins.mode not in ["ADDR_MODE_IMMEDIATE", "ADDR_MODE_IMPLIED_BRK"]:
+                operand = self.prg_rom[offset + 1]
+            else:
+                operand = 0
+
+            # blocks are found through the decode cache, which doesn't cache instructions crossing pages
+            if len(block) == 0 and (end >> 8) != (offset >> 8):
+                successors.append((offset + ins.size, addr + ins.size))
+                break
+
+            if not self.is_safe(ins, operand):
+                if ins.mode not in ["ADDR_MODE_INDIRECT", "ADDR_MODE_IMPLIED_BRK"]:
+                    successors.append((offset + ins.size, addr + ins.size))
+                break
+
+            max_cycles = ins.cycles + (1 if ins.page_cross_cycle else 0) + (2 if ins.mode == "ADDR_MODE_RELATIVE" else 0)
+            if cycles + max_cycles > BLOCK_MAX_CYCLES:
+                successors.append((offset, addr))
+                break
+
+            block.append((ins, operand, addr))
+            cycles += max_cycles
+            prg_ram = prg_ram or self.writes_prg_ram(ins, operand)
+
+            if ins.mode == "ADDR_MODE_RELATIVE":
+                target = (addr + 2 + (operand - 0x100 if operand >= 0x80 else operand)) & 0xffff
+                successors += [(o, target) for o in self.get_target_offsets(offset, addr, target)]
+                successors.append((offset + ins.size, addr + ins.size))
+                break
+            elif ins.opcode in [OPCODE_JMP, OPCODE_JSR]:
+                successors += [(o, operand) for o in self.get_target_offsets(offset, addr, operand)]
+                if ins.opcode == OPCODE_JSR:
+                    successors.append((offset + ins.size, addr + ins.size))
+                break
+            elif ins.opcode in [OPCODE_RTS, OPCODE_RTI]:
+                break
+
+            offset += ins.size
+            addr += ins.size
+
+        if len(block) > 0:
+            self.blocks[start_offset] = (start_addr, block, cycles, prg_ram)
+        return [(o, a & 0xffff) for (o, a) in successors]
+
+    def generate(self, name, input_name):
+        hash = 5381
+        for b in self.prg_rom:
+            hash = ((hash << 5) + hash + b) & 0xffffffff
+
+        lines = []
+        lines.append("// Generated by utils/recompile.py from " + input_name + ", do not edit.")
+        lines.append("// Compile it instead of agnes.c and enable with:")
+        lines.append("//     const agnes_static_code_t* agnes_static_code_" + name + "(void);")
+        lines.append("//     agnes_set_static_code(agnes, agnes_static_code_" + name + "());")
+        lines.append("")
+        lines.append("#include \"agnes.c\"")
+        lines.append("")
+
+        offsets = sorted(self.blocks.keys())
+        for offset in offsets:
+            start_addr, block, cycles, prg_ram = self.blocks[offset]
+            lines.append("static int %s(cpu_t *cpu) { // prg rom offset 0x%05x" % (self.get_block_name(offset, start_addr), offset))
+            lines.append("    int cycles = 0;")
+            for ins, operand, addr in block:
+                lines.append("    cycles += execute(cpu, 0x%04x, %s, %s, %d, %s); // %04x: %s" % (
+                    operand, ins.op, ins.mode, ins.cycles, "true" if ins.page_cross_cycle else "false", addr, ins.name))
+            lines.append("    return cycles;")
+            lines.append("}")
+            lines.append("")
+
+        lines.append("static const static_block_t g_static_blocks_%s[] = {" % name)
+        for offset in offsets:
+            start_addr, block, cycles, prg_ram = self.blocks[offset]
+            lines.append("    { 0x%05x, %d, %s, %s }," % (offset, cycles, "true" if prg_ram else "false",
+                                                    self.get_block_name(offset, start_addr)))
+        if len(offsets) == 0:
+            lines.append("    { 0, 0, false, NULL },")
+        lines.append("};")
+        lines.append("")
+        lines.append("static const agnes_static_code_t g_static_code_%s = { 0x%08x, g_static_blocks_%s, %d };" % (name, hash, name, len(offsets)))
+        lines.append("")
+        lines.append("const agnes_static_code_t* agnes_static_code_%s(void) {" % name)
+        lines.append("    return &g_static_code_%s;" % name)
+        lines.append("}")
+        lines.append("")
+        return "\n".join(lines)
+
+    # Tagged with 8KB bank number and cpu address of the first instruction
+    def get_block_name(self, offset, addr):
+        return "block_%02x_%04x" % (offset >> 13, addr)
+
+def main():
+    script_dir = os.path.dirname(os.path.realpath(__file__))
+
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--input", required=True)
+    parser.add_argument("--output", required=True)
+    parser.add_argument("--name", required=False)
+    parser.add_argument("--instructions", required=False, default=os.path.join(script_dir, "..", "src", "instructions.c"))
+    args = parser.parse_args()
+
+    name = args.name
+    if name is None:
+        name = os.path.splitext(os.path.basename(args.input))[0]
+    name = re.sub(r"\W", "_", name)
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+
+    recompiler = Recompiler(data, parse_instructions(args.instructions))
+    recompiler.walk([0xfffc, 0xfffa, 0xfffe])
+    if len(recompiler.blocks) >= MAX_BLOCKS:
+        print("Too many blocks, stopped at " + str(MAX_BLOCKS))
+
+    with open(args.output, "w") as f:
+        f.write(recompiler.generate(name, os.path.basename(args.input)))
+    print("Generated " + str(len(recompiler.blocks)) + " blocks")
+
+if __name__ == "__main__":
+    main()